@@ -0,0 +1,115 @@
+#ifndef INCLUDE_CKPT
+#define INCLUDE_CKPT
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+
+// Checkpoints are little-endian PFM files (RGB, bottom row first) followed
+// by a trailer with the accumulated sample count and the scene hash, so any
+// HDR viewer can open them and we can still resume from them.
+#define CKPT_MAGIC "LCKP"
+#define CKPT_MAX_SIZE 16384
+
+typedef struct {
+    int width;
+    int height;
+    uint64_t sample_count;
+    uint64_t scene_hash;
+    float *pixels; // RGBA, top row first
+} ckpt;
+
+static void ckpt_free(ckpt *c) {
+    mem_heap_free(c->pixels);
+    c->pixels = NULL;
+}
+
+static bool ckpt_write(const char *path, const ckpt *c) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    size_t mark = mem_frame_mark();
+    float *row = mem_frame_alloc(sizeof(float) * 3 * c->width);
+    fprintf(file, "PF\n%d %d\n-1.0\n", c->width, c->height);
+    for (int y = c->height - 1; y >= 0; y--) {
+        const float *src = &c->pixels[(size_t)y * c->width * 4];
+        for (int x = 0; x < c->width; x++) {
+            row[x * 3 + 0] = src[x * 4 + 0];
+            row[x * 3 + 1] = src[x * 4 + 1];
+            row[x * 3 + 2] = src[x * 4 + 2];
+        }
+        fwrite(row, sizeof(float) * 3, c->width, file);
+    }
+    mem_frame_release(mark);
+    fwrite(CKPT_MAGIC, 4, 1, file);
+    fwrite(&c->sample_count, sizeof(c->sample_count), 1, file);
+    fwrite(&c->scene_hash, sizeof(c->scene_hash), 1, file);
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+static bool ckpt_read(const char *path, ckpt *c) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    float scale;
+    c->pixels = NULL;
+    if (fscanf(file, "PF %d %d %f", &c->width, &c->height, &scale) != 3 || fgetc(file) != '\n' ||
+        scale >= 0.0f || c->width <= 0 || c->height <= 0 || c->width > CKPT_MAX_SIZE ||
+        c->height > CKPT_MAX_SIZE) {
+        fclose(file);
+        return false;
+    }
+    size_t mark = mem_frame_mark();
+    c->pixels = mem_heap_alloc(sizeof(float) * 4 * c->width * c->height);
+    float *row = mem_frame_alloc(sizeof(float) * 3 * c->width);
+    bool ok = c->pixels != NULL;
+    for (int y = c->height - 1; y >= 0 && ok; y--) {
+        ok = fread(row, sizeof(float) * 3, c->width, file) == (size_t)c->width;
+        float *dst = &c->pixels[(size_t)y * c->width * 4];
+        for (int x = 0; x < c->width; x++) {
+            dst[x * 4 + 0] = row[x * 3 + 0];
+            dst[x * 4 + 1] = row[x * 3 + 1];
+            dst[x * 4 + 2] = row[x * 3 + 2];
+            dst[x * 4 + 3] = 1.0f;
+        }
+    }
+    mem_frame_release(mark);
+    char magic[4];
+    ok = ok && fread(magic, sizeof(magic), 1, file) && memcmp(magic, CKPT_MAGIC, 4) == 0 &&
+         fread(&c->sample_count, sizeof(c->sample_count), 1, file) &&
+         fread(&c->scene_hash, sizeof(c->scene_hash), 1, file);
+    fclose(file);
+    if (!ok) {
+        ckpt_free(c);
+    }
+    return ok;
+}
+
+// Accumulates `src` into `dst`, weighting both by their sample counts.
+static bool ckpt_merge(ckpt *dst, const ckpt *src) {
+    if (dst->width != src->width || dst->height != src->height || dst->scene_hash != src->scene_hash) {
+        return false;
+    }
+    uint64_t total = dst->sample_count + src->sample_count;
+    if (total == 0) {
+        return true;
+    }
+    double wd = (double)dst->sample_count / total;
+    double ws = (double)src->sample_count / total;
+    size_t n = (size_t)dst->width * dst->height * 4;
+    for (size_t i = 0; i < n; i++) {
+        dst->pixels[i] = (float)(dst->pixels[i] * wd + src->pixels[i] * ws);
+    }
+    dst->sample_count = total;
+    return true;
+}
+
+#endif
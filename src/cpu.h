@@ -0,0 +1,155 @@
+#ifndef INCLUDE_CPU
+#define INCLUDE_CPU
+
+#include <math.h>
+#include <stdint.h>
+
+#define HANDMADE_MATH_NO_SSE
+#include <vendor/Handmade-Math/HandmadeMath.h>
+
+#include "gfx.h"
+
+// CPU port of traceRay() from shd_trace.glsl for headless rendering, with
+// the constants of any trace variant. Randomness comes from PCG32 instead of
+// the shader's sin() hash so every batch can draw from its own stream.
+#define CPU_T_MIN 1e-4f
+#define CPU_T_MAX 1e30f
+
+typedef struct {
+    const hmm_v4 *vertices;
+    const hmm_v4 *materials;
+    size_t count;
+} cpu_scene;
+
+typedef struct {
+    uint64_t state;
+    uint64_t inc;
+} cpu_rng;
+
+typedef struct {
+    float t_min;
+    float t_max;
+    material_type mat;
+    hmm_v3 color;
+    hmm_v2 n;
+} cpu_isect;
+
+static uint32_t cpu_rng_next(cpu_rng *rng) {
+    uint64_t old = rng->state;
+    rng->state = old * 6364136223846793005ull + rng->inc;
+    uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+    uint32_t rot = (uint32_t)(old >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+static void cpu_rng_seed(cpu_rng *rng, uint64_t seed, uint64_t stream) {
+    rng->state = 0;
+    rng->inc = (stream << 1u) | 1u;
+    cpu_rng_next(rng);
+    rng->state += seed;
+    cpu_rng_next(rng);
+}
+
+static float cpu_rng_float(cpu_rng *rng) {
+    return (cpu_rng_next(rng) >> 8) * (1.0f / 16777216.0f);
+}
+
+static hmm_v2 cpu_sample_circle(cpu_rng *rng) {
+    float theta = 2.0f * HMM_PI32 * cpu_rng_float(rng);
+    return HMM_Vec2(cosf(theta), sinf(theta));
+}
+
+static void cpu_intersect(const cpu_scene *scene, hmm_v2 origin, hmm_v2 dir, cpu_isect *isect) {
+    for (size_t i = 0; i < scene->count; i++) {
+        hmm_v4 v = scene->vertices[i];
+        hmm_v2 a = v.XY;
+        hmm_v2 st = HMM_SubtractVec2(v.ZW, a);
+        hmm_v2 sn = HMM_Vec2(-st.Y, st.X);
+        float t = HMM_DotVec2(sn, HMM_SubtractVec2(a, origin)) / HMM_DotVec2(sn, dir);
+        hmm_v2 hit = HMM_AddVec2(origin, HMM_MultiplyVec2f(dir, t));
+        float u = HMM_DotVec2(st, HMM_SubtractVec2(hit, a));
+        if (!(t >= isect->t_min && t < isect->t_max) || u < 0.0f || u > HMM_DotVec2(st, st)) {
+            continue;
+        }
+        hmm_v4 m = scene->materials[i];
+        isect->t_max = t;
+        isect->mat = (material_type)m.W;
+        isect->color = m.RGB;
+        isect->n = HMM_NormalizeVec2(sn);
+    }
+}
+
+static hmm_v3 cpu_trace_ray(
+    const cpu_scene *scene, const gfx_trace_variant *variant, hmm_v2 origin, hmm_v2 dir, cpu_rng *rng) {
+    hmm_v3 color = HMM_Vec3(0.0f, 0.0f, 0.0f);
+    hmm_v3 mask = HMM_Vec3(1.0f, 1.0f, 1.0f);
+
+    for (int ibounce = 0; ibounce < variant->bounce_count; ibounce++) {
+        cpu_isect isect = {
+            .t_min = CPU_T_MIN,
+            .t_max = CPU_T_MAX,
+        };
+        cpu_intersect(scene, origin, dir, &isect);
+
+        if (isect.t_max == CPU_T_MAX) {
+            break;
+        }
+        if (isect.mat == MAT_LIGHT) {
+            float cos_theta = fabsf(HMM_DotVec2(HMM_NormalizeVec2(dir), isect.n));
+            float d = 1.0f - isect.t_max * (float)TRACE_DIST_COEF;
+            hmm_v3 light = HMM_MultiplyVec3f(isect.color, cos_theta * d * (float)TRACE_LIGHT_COEF);
+            color = HMM_AddVec3(color, HMM_MultiplyVec3(mask, light));
+            break;
+        }
+        origin = HMM_AddVec2(origin, HMM_MultiplyVec2f(dir, isect.t_max));
+        if (isect.mat == MAT_REFLECT) {
+            dir = HMM_SubtractVec2(dir, HMM_MultiplyVec2f(isect.n, 2.0f * HMM_DotVec2(dir, isect.n)));
+        } else {
+            dir = HMM_MultiplyVec2f(HMM_AddVec2(isect.n, cpu_sample_circle(rng)), 200.0f);
+        }
+        mask = HMM_MultiplyVec3(mask, isect.color);
+
+        if (variant->roulette && ibounce >= TRACE_RR_MIN_BOUNCE) {
+            float survive = HMM_Clamp(0.05f, HMM_MAX(mask.R, HMM_MAX(mask.G, mask.B)), 1.0f);
+            if (cpu_rng_float(rng) > survive) {
+                break;
+            }
+            mask = HMM_MultiplyVec3f(mask, 1.0f / survive);
+        }
+    }
+
+    return color;
+}
+
+// Renders the average of `samples` new samples per pixel into `pixels`
+// (RGBA, top row first), drawing all randomness from `stream`. Like a shader
+// pass, every sample averages the variant's sample count of rays.
+static void cpu_trace_batch(const cpu_scene *scene,
+                            const gfx_trace_variant *variant,
+                            int width,
+                            int height,
+                            uint32_t samples,
+                            uint64_t stream,
+                            float *pixels) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            size_t index = (size_t)y * width + x;
+            cpu_rng rng;
+            cpu_rng_seed(&rng, index, stream);
+            hmm_v2 coord = HMM_Vec2(x + 0.5f, y + 0.5f);
+            hmm_v3 color = HMM_Vec3(0.0f, 0.0f, 0.0f);
+            uint32_t rays = samples * (uint32_t)variant->sample_count;
+            for (uint32_t i = 0; i < rays; i++) {
+                hmm_v2 dir = HMM_MultiplyVec2f(cpu_sample_circle(&rng), 500.0f);
+                color = HMM_AddVec3(color, cpu_trace_ray(scene, variant, coord, dir, &rng));
+            }
+            color = HMM_DivideVec3f(color, (float)rays);
+            pixels[index * 4 + 0] = color.R;
+            pixels[index * 4 + 1] = color.G;
+            pixels[index * 4 + 2] = color.B;
+            pixels[index * 4 + 3] = 1.0f;
+        }
+    }
+}
+
+#endif
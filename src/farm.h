@@ -0,0 +1,353 @@
+#ifndef INCLUDE_FARM
+#define INCLUDE_FARM
+
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ckpt.h"
+#include "cpu.h"
+#include "mem.h"
+#include "utils.h"
+
+// Headless render farm. The coordinator listens on a TCP port, hands every
+// worker the scene and then one sample batch at a time, each with its own
+// RNG stream, and merges the returned averages weighted by sample count.
+// Workers can be spawned locally or started by hand on other machines.
+#define FARM_MAGIC 0x4d524146
+#define FARM_MAX_WORKERS 64
+#define FARM_POLL_MS 1000
+
+typedef struct {
+    uint32_t magic;
+    int32_t width;
+    int32_t height;
+    uint32_t shape_count;
+    uint32_t variant;
+    uint64_t scene_hash;
+} farm_job;
+
+// Sent to a worker for every batch, zero samples means stop.
+typedef struct {
+    uint64_t stream;
+    uint64_t samples;
+} farm_batch;
+
+typedef struct {
+    const char *self_path;
+    const char *port;
+    const char *out_path;
+    cpu_scene scene;
+    size_t variant;
+    uint64_t scene_hash; // including the variant, see gfx_trace_hash()
+    int width;
+    int height;
+    uint64_t samples;
+    uint64_t batch_samples;
+    int local_workers;
+} farm_desc;
+
+typedef struct {
+    int fd;
+    bool busy;
+    farm_batch batch;
+} farm_worker;
+
+extern char **environ;
+
+static bool farm_send_all(int fd, const void *data, size_t size) {
+    const uint8_t *p = data;
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static bool farm_recv_all(int fd, void *data, size_t size) {
+    uint8_t *p = data;
+    while (size > 0) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+static int farm_open(const char *host, const char *port, bool listening) {
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = listening ? AI_PASSIVE : 0,
+    };
+    struct addrinfo *res;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (listening) {
+            int yes = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+            if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, FARM_MAX_WORKERS) == 0) {
+                break;
+            }
+        } else if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static int farm_work(const char *host, const char *port) {
+    signal(SIGPIPE, SIG_IGN);
+    int fd = farm_open(host, port, false);
+    if (fd < 0) {
+        printf("farm: cannot connect to %s:%s\n", host, port);
+        return 1;
+    }
+    farm_job job;
+    if (!farm_recv_all(fd, &job, sizeof(job)) || job.magic != FARM_MAGIC || job.width <= 0 ||
+        job.height <= 0 || job.width > CKPT_MAX_SIZE || job.height > CKPT_MAX_SIZE ||
+        job.shape_count > GFX_SHAPE_MAX_COUNT || job.variant >= GFX_TRACE_VARIANT_COUNT) {
+        printf("farm: bad job from %s:%s\n", host, port);
+        close(fd);
+        return 1;
+    }
+    size_t pixels_size = sizeof(float) * 4 * job.width * job.height;
+    hmm_v4 *vertices = mem_heap_alloc(sizeof(hmm_v4) * job.shape_count);
+    hmm_v4 *materials = mem_heap_alloc(sizeof(hmm_v4) * job.shape_count);
+    float *pixels = mem_heap_alloc(pixels_size);
+    cpu_scene scene = {
+        .vertices = vertices,
+        .materials = materials,
+        .count = job.shape_count,
+    };
+    bool ok = vertices && materials && pixels &&
+              farm_recv_all(fd, vertices, sizeof(hmm_v4) * job.shape_count) &&
+              farm_recv_all(fd, materials, sizeof(hmm_v4) * job.shape_count);
+    const gfx_trace_variant *variant = &gfx_trace_variants[job.variant];
+    farm_batch batch;
+    while (ok && farm_recv_all(fd, &batch, sizeof(batch)) && batch.samples > 0) {
+        cpu_trace_batch(
+            &scene, variant, job.width, job.height, (uint32_t)batch.samples, batch.stream, pixels);
+        ok = farm_send_all(fd, &batch, sizeof(batch)) && farm_send_all(fd, pixels, pixels_size);
+    }
+    mem_heap_free(pixels);
+    mem_heap_free(materials);
+    mem_heap_free(vertices);
+    close(fd);
+    return ok ? 0 : 1;
+}
+
+static bool farm_start(const farm_desc *desc, int fd) {
+    farm_job job = {
+        .magic = FARM_MAGIC,
+        .width = desc->width,
+        .height = desc->height,
+        .shape_count = (uint32_t)desc->scene.count,
+        .variant = (uint32_t)desc->variant,
+        .scene_hash = desc->scene_hash,
+    };
+    return farm_send_all(fd, &job, sizeof(job)) &&
+           farm_send_all(fd, desc->scene.vertices, sizeof(hmm_v4) * desc->scene.count) &&
+           farm_send_all(fd, desc->scene.materials, sizeof(hmm_v4) * desc->scene.count);
+}
+
+static bool farm_check_desc(const farm_desc *desc) {
+    return desc->width > 0 && desc->height > 0 && desc->width <= CKPT_MAX_SIZE &&
+           desc->height <= CKPT_MAX_SIZE && desc->samples > 0 && desc->batch_samples > 0 &&
+           desc->local_workers >= 0 && desc->local_workers <= FARM_MAX_WORKERS &&
+           desc->scene.count <= GFX_SHAPE_MAX_COUNT && desc->variant < GFX_TRACE_VARIANT_COUNT;
+}
+
+// Reaps local workers that exited, returns how many are still running.
+static int farm_reap(pid_t *pids, int pid_count) {
+    int alive = 0;
+    for (int i = 0; i < pid_count; i++) {
+        if (pids[i] > 0 && waitpid(pids[i], NULL, WNOHANG) == pids[i]) {
+            pids[i] = 0;
+        }
+        alive += pids[i] > 0;
+    }
+    return alive;
+}
+
+static int farm_coordinate(const farm_desc *desc) {
+    if (!farm_check_desc(desc)) {
+        printf("farm: invalid job, need a positive size up to %d, samples and at most %d local workers\n",
+               CKPT_MAX_SIZE,
+               FARM_MAX_WORKERS);
+        return 1;
+    }
+    size_t pixels_size = sizeof(float) * 4 * desc->width * desc->height;
+    ckpt acc = {
+        .width = desc->width,
+        .height = desc->height,
+        .scene_hash = desc->scene_hash,
+        .pixels = mem_heap_alloc(pixels_size),
+    };
+    ckpt part = acc;
+    part.pixels = mem_heap_alloc(pixels_size);
+    if (acc.pixels) {
+        memset(acc.pixels, 0, pixels_size);
+    }
+    // Writing the empty checkpoint up front catches a bad output path
+    // before any work is done.
+    if (!acc.pixels || !part.pixels || !ckpt_write(desc->out_path, &acc)) {
+        printf("farm: cannot write %s\n", desc->out_path);
+        ckpt_free(&part);
+        ckpt_free(&acc);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    int listen_fd = farm_open(NULL, desc->port, true);
+    if (listen_fd < 0) {
+        printf("farm: cannot listen on port %s\n", desc->port);
+        ckpt_free(&part);
+        ckpt_free(&acc);
+        return 1;
+    }
+
+    pid_t pids[FARM_MAX_WORKERS];
+    int pid_count = 0;
+    for (int i = 0; i < desc->local_workers; i++) {
+        char *args[] = {(char *)desc->self_path, "--farm-worker", "127.0.0.1", (char *)desc->port, NULL};
+        int err = posix_spawnp(&pids[pid_count], desc->self_path, NULL, NULL, args, environ);
+        if (err != 0) {
+            printf("farm: cannot start worker %s: %s\n", desc->self_path, strerror(err));
+            continue;
+        }
+        pid_count++;
+    }
+    if (desc->local_workers == 0) {
+        printf("farm: waiting for workers on port %s\n", desc->port);
+    }
+
+    farm_worker workers[FARM_MAX_WORKERS];
+    int worker_count = 0;
+    uint64_t issued = 0;
+    uint64_t next_stream = 0;
+    bool written = true;
+    int res = 0;
+
+    while (acc.sample_count < desc->samples) {
+        // Without remote workers in the plan, nobody else will show up.
+        if (worker_count == 0 && desc->local_workers > 0 && farm_reap(pids, pid_count) == 0) {
+            printf("farm: no workers left\n");
+            res = 1;
+            break;
+        }
+
+        // Hand out batches until every sample is spoken for.
+        for (int i = 0; i < worker_count; i++) {
+            farm_worker *w = &workers[i];
+            if (w->busy || issued >= desc->samples) {
+                continue;
+            }
+            uint64_t left = desc->samples - issued;
+            w->batch = (farm_batch){
+                .stream = next_stream++,
+                .samples = left < desc->batch_samples ? left : desc->batch_samples,
+            };
+            w->busy = farm_send_all(w->fd, &w->batch, sizeof(w->batch));
+            if (w->busy) {
+                issued += w->batch.samples;
+            }
+        }
+
+        // Stop listening while full, a pending connection would keep waking
+        // poll() up.
+        struct pollfd fds[FARM_MAX_WORKERS + 1];
+        fds[0] = (struct pollfd){.fd = worker_count < FARM_MAX_WORKERS ? listen_fd : -1, .events = POLLIN};
+        for (int i = 0; i < worker_count; i++) {
+            fds[i + 1] = (struct pollfd){.fd = workers[i].fd, .events = POLLIN};
+        }
+        if (poll(fds, worker_count + 1, FARM_POLL_MS) <= 0) {
+            continue;
+        }
+
+        for (int i = worker_count - 1; i >= 0; i--) {
+            if (!fds[i + 1].revents) {
+                continue;
+            }
+            farm_worker *w = &workers[i];
+            farm_batch batch;
+            bool ok = w->busy && farm_recv_all(w->fd, &batch, sizeof(batch)) &&
+                      batch.stream == w->batch.stream && farm_recv_all(w->fd, part.pixels, pixels_size);
+            if (!ok) {
+                // Lost worker, its batch goes back to the pool.
+                if (w->busy) {
+                    issued -= w->batch.samples;
+                }
+                close(w->fd);
+                workers[i] = workers[--worker_count];
+                continue;
+            }
+            w->busy = false;
+            part.sample_count = batch.samples;
+            ckpt_merge(&acc, &part);
+            written = ckpt_write(desc->out_path, &acc);
+            if (!written) {
+                printf("farm: cannot write %s\n", desc->out_path);
+            }
+            printf("farm: %llu/%llu samples, %d workers\n",
+                   (unsigned long long)acc.sample_count,
+                   (unsigned long long)desc->samples,
+                   worker_count);
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0 && farm_start(desc, fd)) {
+                workers[worker_count++] = (farm_worker){.fd = fd};
+            } else if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    farm_batch stop = {0};
+    for (int i = 0; i < worker_count; i++) {
+        farm_send_all(workers[i].fd, &stop, sizeof(stop));
+        close(workers[i].fd);
+    }
+    close(listen_fd);
+    for (int i = 0; i < pid_count; i++) {
+        if (pids[i] > 0) {
+            if (res != 0) {
+                kill(pids[i], SIGTERM);
+            }
+            waitpid(pids[i], NULL, 0);
+        }
+    }
+    ckpt_free(&part);
+    ckpt_free(&acc);
+    return written ? res : 1;
+}
+
+#endif
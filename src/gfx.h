@@ -1,8 +1,10 @@
 #ifndef INCLUDE_GFX
 #define INCLUDE_GFX
 
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define HANDMADE_MATH_NO_SSE
 #include <vendor/Handmade-Math/HandmadeMath.h>
@@ -13,11 +15,30 @@
 #include <vendor/sokol/sokol_glue.h>
 #include <vendor/sokol/sokol_time.h>
 
+#include "ckpt.h"
+#include "sdf.h"
 #include "ui.h"
 #include "utils.h"
-#include "shd_trace.h"
+#include "trace_config.h"
+#include "shd_trace_draft.h"
+#include "shd_trace_draft_rr.h"
+#include "shd_trace_normal.h"
+#include "shd_trace_normal_rr.h"
+#include "shd_trace_high.h"
+#include "shd_trace_high_rr.h"
 #include "shd_screen.h"
 
+// Trace variants only differ in constants and share one interface.
+typedef trace_normal_vs_trace_params_t vs_trace_params_t;
+typedef trace_normal_fs_trace_params_t fs_trace_params_t;
+#define ATTR_vs_trace_position ATTR_trace_normal_vs_trace_position
+#define ATTR_vs_trace_uv0 ATTR_trace_normal_vs_trace_uv0
+#define SLOT_vs_trace_params SLOT_trace_normal_vs_trace_params
+#define SLOT_fs_trace_params SLOT_trace_normal_fs_trace_params
+#define SLOT_prev_target SLOT_trace_normal_prev_target
+#define SLOT_sdf SLOT_trace_normal_sdf
+#define SLOT_sdf_items SLOT_trace_normal_sdf_items
+
 #define GFX_SHAPE_MAX_COUNT 512
 #define GFX_SHAPE_VERTS_PER_PIXEL 2
 #define GFX_SHAPE_VERTS 2
@@ -33,19 +54,68 @@ typedef struct {
     material_type type;
 } material;
 
+typedef struct {
+    const char *name;
+    const char *label;
+    int bounce_count;
+    int sample_count;
+    bool roulette;
+    const sg_shader_desc *(*shader_desc)(void);
+} gfx_trace_variant;
+
+// Constants come from build/trace_config.h, generated by the Makefile.
+#define GFX_TRACE_VARIANT(v, label)                                                                          \
+    {#v, label, TRACE_##v##_BOUNCE_COUNT, TRACE_##v##_SAMPLE_COUNT, TRACE_##v##_RUSSIAN_ROULETTE,            \
+     trace_##v##_sh_trace_shader_desc}
+
+// Same order as TRACE_VARIANTS in the Makefile.
+static const gfx_trace_variant gfx_trace_variants[] = {
+    GFX_TRACE_VARIANT(draft, "Q: Draft"),
+    GFX_TRACE_VARIANT(draft_rr, "Q: Draft"),
+    GFX_TRACE_VARIANT(normal, "Q: Normal"),
+    GFX_TRACE_VARIANT(normal_rr, "Q: Normal"),
+    GFX_TRACE_VARIANT(high, "Q: High"),
+    GFX_TRACE_VARIANT(high_rr, "Q: High"),
+};
+
+#define GFX_TRACE_VARIANT_COUNT (sizeof(gfx_trace_variants) / sizeof(gfx_trace_variants[0]))
+#define GFX_TRACE_VARIANT_DEFAULT 2
+
 typedef void (*gfx_shape_func)(hmm_v2 a, hmm_v2 b, material m, void *data);
 
+// Implemented in sokol.m, copies `img` into `dst` once the GPU is done with
+// the frames committed so far, then sets `done`.
+void mtl_read_image_async(sg_image img, int width, int height, void *dst, atomic_bool *done);
+
 static struct {
     struct {
         size_t sample_count;
+        uint64_t scene_hash;
+        int width;
+        int height;
         sg_image targets[2];
+        sg_image resume_target;
         sg_pass passes[2];
         vs_trace_params_t vsp;
         fs_trace_params_t fsp;
-        sg_shader shader;
+        size_t variant;
+        sg_shader shaders[GFX_TRACE_VARIANT_COUNT];
+        sg_pipeline pipelines[GFX_TRACE_VARIANT_COUNT];
         sg_pipeline pipeline;
         sg_bindings bindings;
     } trace;
+    struct {
+        bool enabled;
+        uint64_t scene_hash;
+        sg_image image;
+        sg_image items;
+    } sdf;
+    struct {
+        bool requested;
+        bool busy;
+        atomic_bool done;
+        ckpt result;
+    } readback;
     struct {
         vs_screen_params_t vsp;
         sg_pass_action pass_action;
@@ -57,6 +127,34 @@ static struct {
     } screen;
 } gfx;
 
+// Pipelines are created on first use, so unused variants cost nothing.
+static void gfx_set_trace_variant(size_t variant) {
+    expect(variant < GFX_TRACE_VARIANT_COUNT, "trace variant");
+    if (gfx.trace.pipelines[variant].id == SG_INVALID_ID) {
+        gfx.trace.shaders[variant] = sg_make_shader(gfx_trace_variants[variant].shader_desc());
+        gfx.trace.pipelines[variant] = sg_make_pipeline(&(sg_pipeline_desc){
+            .shader = gfx.trace.shaders[variant],
+            .index_type = SG_INDEXTYPE_UINT16,
+            .blend =
+                {
+                    .color_format = SG_PIXELFORMAT_RGBA32F,
+                    .depth_format = SG_PIXELFORMAT_NONE,
+                },
+            .layout = {.attrs =
+                           {
+                               [ATTR_vs_trace_position].format = SG_VERTEXFORMAT_FLOAT2,
+                               [ATTR_vs_trace_uv0].format = SG_VERTEXFORMAT_FLOAT2,
+                           }},
+            .label = "trace-pipeline",
+        });
+    }
+    if (variant != gfx.trace.variant) {
+        gfx.trace.sample_count = 0;
+    }
+    gfx.trace.variant = variant;
+    gfx.trace.pipeline = gfx.trace.pipelines[variant];
+}
+
 static void gfx_setup(void) {
     sg_setup(&(sg_desc){
         .context = sapp_sgcontext(),
@@ -109,6 +207,12 @@ static void gfx_setup(void) {
         .label = "trace-target",
     };
     gfx.trace.sample_count = 0;
+    gfx.trace.width = target_desc.width;
+    gfx.trace.height = target_desc.height;
+    // One readback buffer for the lifetime of the targets, every checkpoint
+    // reuses it.
+    gfx.readback.result.pixels = mem_heap_alloc(sizeof(float) * 4 * target_desc.width * target_desc.height);
+    expect(gfx.readback.result.pixels != NULL, "cannot allocate readback buffer");
     gfx.trace.targets[0] = sg_make_image(&target_desc);
     gfx.trace.targets[1] = sg_make_image(&target_desc);
     gfx.trace.passes[0] = sg_make_pass(&(sg_pass_desc){
@@ -119,27 +223,34 @@ static void gfx_setup(void) {
         .color_attachments[0].image = gfx.trace.targets[1],
         .label = "trace-pass",
     });
-    gfx.trace.shader = sg_make_shader(sh_trace_shader_desc());
-    gfx.trace.pipeline = sg_make_pipeline(&(sg_pipeline_desc){
-        .shader = gfx.trace.shader,
-        .index_type = SG_INDEXTYPE_UINT16,
-        .blend =
-            {
-                .color_format = SG_PIXELFORMAT_RGBA32F,
-                .depth_format = SG_PIXELFORMAT_NONE,
-            },
-        .layout = {.attrs =
-                       {
-                           [ATTR_vs_trace_position].format = SG_VERTEXFORMAT_FLOAT2,
-                           [ATTR_vs_trace_uv0].format = SG_VERTEXFORMAT_FLOAT2,
-                       }},
-        .label = "trace-pipeline",
-    });
+    gfx_set_trace_variant(GFX_TRACE_VARIANT_DEFAULT);
     gfx.trace.bindings = (sg_bindings){
         .vertex_buffers = {gfx.screen.vertices},
         .index_buffer = gfx.screen.indices,
     };
 
+    sdf_setup(GFX_SHAPE_MAX_COUNT);
+    gfx.sdf.image = sg_make_image(&(sg_image_desc){
+        .width = SDF_SIZE,
+        .height = SDF_SIZE,
+        .usage = SG_USAGE_DYNAMIC,
+        .pixel_format = SG_PIXELFORMAT_RGBA32F,
+        .min_filter = SG_FILTER_NEAREST,
+        .mag_filter = SG_FILTER_NEAREST,
+        .label = "trace-sdf",
+    });
+    gfx.sdf.items = sg_make_image(&(sg_image_desc){
+        .width = SDF_ITEMS_WIDTH,
+        .height = SDF_ITEMS_MAX / SDF_ITEMS_WIDTH,
+        .usage = SG_USAGE_DYNAMIC,
+        .pixel_format = SG_PIXELFORMAT_R32F,
+        .min_filter = SG_FILTER_NEAREST,
+        .mag_filter = SG_FILTER_NEAREST,
+        .label = "trace-sdf-items",
+    });
+    gfx.trace.bindings.fs_images[SLOT_sdf] = gfx.sdf.image;
+    gfx.trace.bindings.fs_images[SLOT_sdf_items] = gfx.sdf.items;
+
     gfx.screen.shader = sg_make_shader(sh_screen_shader_desc());
     gfx.screen.pipeline = sg_make_pipeline(&(sg_pipeline_desc){
         .shader = gfx.screen.shader,
@@ -171,12 +282,126 @@ static void gfx_append_shape(hmm_v2 a, hmm_v2 b, material m) {
     gfx.trace.fsp.shape_vertices[c] = HMM_Vec4(a.X, a.Y, b.X, b.Y);
     gfx.trace.fsp.shape_materials[c] = HMM_Vec4v(m.color, m.type);
     gfx.trace.fsp.shape_count++;
-    gfx.trace.sample_count = 0;
 }
 
 static void gfx_clear_shapes(void) {
     gfx.trace.fsp.shape_count = 0;
-    gfx.trace.sample_count = 0;
+}
+
+static void gfx_truncate_shapes(size_t count) {
+    if (count < gfx.trace.fsp.shape_count) {
+        gfx.trace.fsp.shape_count = count;
+    }
+}
+
+// Removes a range of shapes, keeping the order of the ones after it.
+static void gfx_remove_shapes(size_t first, size_t count) {
+    size_t c = gfx.trace.fsp.shape_count;
+    expect(first + count <= c, "shape range");
+    memmove(&gfx.trace.fsp.shape_vertices[first],
+            &gfx.trace.fsp.shape_vertices[first + count],
+            (c - first - count) * sizeof(gfx.trace.fsp.shape_vertices[0]));
+    memmove(&gfx.trace.fsp.shape_materials[first],
+            &gfx.trace.fsp.shape_materials[first + count],
+            (c - first - count) * sizeof(gfx.trace.fsp.shape_materials[0]));
+    gfx.trace.fsp.shape_count = c - count;
+}
+
+static uint64_t gfx_scene_hash(void) {
+    size_t c = gfx.trace.fsp.shape_count;
+    uint64_t hash = hash_bytes(HASH_SEED, &c, sizeof(c));
+    hash = hash_bytes(hash, gfx.trace.fsp.shape_vertices, c * sizeof(gfx.trace.fsp.shape_vertices[0]));
+    hash = hash_bytes(hash, gfx.trace.fsp.shape_materials, c * sizeof(gfx.trace.fsp.shape_materials[0]));
+    return hash;
+}
+
+// Identity of an accumulation. Variants converge to different results, so
+// checkpoints only mix when both the scene and the estimator match.
+static uint64_t gfx_trace_hash(uint64_t scene_hash, size_t variant) {
+    const gfx_trace_variant *v = &gfx_trace_variants[variant];
+    float coefs[] = {TRACE_DIST_COEF, TRACE_LIGHT_COEF};
+    int params[] = {v->bounce_count, v->sample_count, v->roulette};
+    uint64_t hash = hash_bytes(scene_hash, v->name, strlen(v->name));
+    hash = hash_bytes(hash, coefs, sizeof(coefs));
+    return hash_bytes(hash, params, sizeof(params));
+}
+
+// Requests a copy of the accumulation buffer at the end of the next frame,
+// pick it up with `gfx_poll_checkpoint()` a few frames later. The polled
+// checkpoint borrows gfx's readback buffer until the next request.
+static void gfx_request_checkpoint(void) {
+    gfx.readback.requested = true;
+}
+
+static bool gfx_poll_checkpoint(ckpt *out) {
+    if (!gfx.readback.busy || !atomic_load(&gfx.readback.done)) {
+        return false;
+    }
+    *out = gfx.readback.result;
+    gfx.readback.busy = false;
+    return true;
+}
+
+// Seeds the accumulation with `c` on the next frame, as long as the scene
+// still hashes the same.
+static bool gfx_resume_checkpoint(const ckpt *c) {
+    if (c->width != gfx.trace.width || c->height != gfx.trace.height) {
+        return false;
+    }
+    if (c->scene_hash != gfx_trace_hash(gfx_scene_hash(), gfx.trace.variant)) {
+        return false;
+    }
+    if (gfx.trace.resume_target.id != SG_INVALID_ID) {
+        sg_destroy_image(gfx.trace.resume_target);
+    }
+    gfx.trace.resume_target = sg_make_image(&(sg_image_desc){
+        .width = c->width,
+        .height = c->height,
+        .pixel_format = SG_PIXELFORMAT_RGBA32F,
+        .min_filter = SG_FILTER_NEAREST,
+        .mag_filter = SG_FILTER_NEAREST,
+        .content = {.subimage[0][0] = {.ptr = c->pixels, .size = sizeof(float) * 4 * c->width * c->height}},
+        .label = "trace-resume",
+    });
+    gfx.trace.sample_count = c->sample_count;
+    return true;
+}
+
+static void gfx_set_accel(bool enabled) {
+    if (enabled && !gfx.sdf.enabled) {
+        sdf_reset();
+        gfx.sdf.scene_hash = 0;
+    }
+    gfx.sdf.enabled = enabled;
+}
+
+static void gfx_update_sdf(uint64_t scene_hash) {
+    if (!gfx.sdf.enabled || scene_hash == gfx.sdf.scene_hash) {
+        return;
+    }
+    gfx.sdf.scene_hash = scene_hash;
+    sdf_update(gfx.trace.fsp.shape_vertices,
+               gfx.trace.fsp.shape_count,
+               HMM_Vec4(0.0f, 0.0f, gfx.trace.width, gfx.trace.height));
+    if (sdf.dirty) {
+        sg_update_image(gfx.sdf.image,
+                        &(sg_image_content){.subimage[0][0] = {.ptr = sdf.cells, .size = sizeof(sdf.cells)}});
+        sg_update_image(gfx.sdf.items,
+                        &(sg_image_content){.subimage[0][0] = {.ptr = sdf.items, .size = sizeof(sdf.items)}});
+        sdf.dirty = false;
+    }
+}
+
+static void gfx_begin_readback(sg_image target) {
+    gfx.readback.requested = false;
+    gfx.readback.busy = true;
+    atomic_store(&gfx.readback.done, false);
+    gfx.readback.result.width = gfx.trace.width;
+    gfx.readback.result.height = gfx.trace.height;
+    gfx.readback.result.sample_count = gfx.trace.sample_count;
+    gfx.readback.result.scene_hash = gfx_trace_hash(gfx.trace.scene_hash, gfx.trace.variant);
+    mtl_read_image_async(
+        target, gfx.trace.width, gfx.trace.height, gfx.readback.result.pixels, &gfx.readback.done);
 }
 
 static void gfx_query_shapes(gfx_shape_func func, void *data) {
@@ -191,16 +416,32 @@ static void gfx_query_shapes(gfx_shape_func func, void *data) {
     }
 }
 
-static void gfx_render(int width, int height, float dpi_scale) {
+static void gfx_render(int width, int height, float dpi_scale, double time) {
     hmm_m4 projection = HMM_Orthographic(0.0f, width / dpi_scale, height / dpi_scale, 0.0f, -1.0f, 1.0f);
+
+    uint64_t scene_hash = gfx_scene_hash();
+    if (scene_hash != gfx.trace.scene_hash) {
+        gfx.trace.scene_hash = scene_hash;
+        gfx.trace.sample_count = 0;
+        if (gfx.trace.resume_target.id != SG_INVALID_ID) {
+            sg_destroy_image(gfx.trace.resume_target);
+            gfx.trace.resume_target.id = SG_INVALID_ID;
+        }
+    }
+    gfx_update_sdf(scene_hash);
     size_t current_target = gfx.trace.sample_count & 0x01;
     size_t prev_target = !current_target;
 
     // trace
-    gfx.trace.fsp.time = stm_sec(stm_now());
+    gfx.trace.fsp.time = time;
+    gfx.trace.fsp.sdf_enabled = gfx.sdf.enabled;
+    gfx.trace.fsp.sdf_domain = sdf.domain;
     gfx.trace.fsp.sample_count = gfx.trace.sample_count++;
     gfx.trace.vsp.projection = projection;
     gfx.trace.bindings.fs_images[SLOT_prev_target] = gfx.trace.targets[prev_target];
+    if (gfx.trace.resume_target.id != SG_INVALID_ID) {
+        gfx.trace.bindings.fs_images[SLOT_prev_target] = gfx.trace.resume_target;
+    }
     sg_begin_pass(gfx.trace.passes[current_target], &gfx.screen.pass_action);
     sg_apply_pipeline(gfx.trace.pipeline);
     sg_apply_bindings(&gfx.trace.bindings);
@@ -215,19 +456,37 @@ static void gfx_render(int width, int height, float dpi_scale) {
     sg_begin_default_pass(&gfx.screen.pass_action, width, height);
     sg_apply_pipeline(gfx.screen.pipeline);
     sg_apply_bindings(&gfx.screen.bindings);
-    sg_apply_uniforms(SG_SHADERSTAGE_VS, SLOT_vs_trace_params, &gfx.screen.vsp, sizeof(gfx.screen.vsp));
+    sg_apply_uniforms(SG_SHADERSTAGE_VS, SLOT_vs_screen_params, &gfx.screen.vsp, sizeof(gfx.screen.vsp));
     sg_draw(0, 3 * 2, 1); // draw 2 triangles
     ui_render(width, height, dpi_scale);
     sg_end_pass();
 
     sg_commit();
+
+    if (gfx.trace.resume_target.id != SG_INVALID_ID) {
+        sg_destroy_image(gfx.trace.resume_target);
+        gfx.trace.resume_target.id = SG_INVALID_ID;
+    }
+    if (gfx.readback.requested && !gfx.readback.busy) {
+        gfx_begin_readback(gfx.trace.targets[current_target]);
+    }
 }
 
 static void gfx_shutdown(void) {
+    // A copy still in flight may write into the buffer, leave it to the OS.
+    if (!gfx.readback.busy) {
+        ckpt_free(&gfx.readback.result);
+    }
     sg_destroy_buffer(gfx.screen.vertices);
     sg_destroy_buffer(gfx.screen.indices);
-    sg_destroy_shader(gfx.trace.shader);
-    sg_destroy_pipeline(gfx.trace.pipeline);
+    sg_destroy_image(gfx.sdf.image);
+    sg_destroy_image(gfx.sdf.items);
+    for (size_t i = 0; i < GFX_TRACE_VARIANT_COUNT; i++) {
+        if (gfx.trace.pipelines[i].id != SG_INVALID_ID) {
+            sg_destroy_pipeline(gfx.trace.pipelines[i]);
+            sg_destroy_shader(gfx.trace.shaders[i]);
+        }
+    }
     sg_shutdown();
 }
 
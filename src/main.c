@@ -2,6 +2,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdnoreturn.h>
+#include <string.h>
+
+#include "mem.h"
 
 #define STBDS_NO_SHORT_NAMES
 #include <vendor/stb/stb_ds.h>
@@ -9,62 +12,246 @@
 #define HANDMADE_MATH_NO_SSE
 #include <vendor/Handmade-Math/HandmadeMath.h>
 
+#include "ckpt.h"
+#include "farm.h"
 #include "gfx.h"
 #include "phx.h"
+#include "rec.h"
 #include "ui.h"
 
 #define SAVE_FILE "state/game.data"
+#define CHECKPOINT_FILE "state/render.pfm"
+#define CONFIG_FILE "state/config.txt"
+#define SAVE_MAGIC "LTR2"
+#define CLOSE_DISTANCE 10.0f
 
 typedef struct {
     size_t vert_count;
+    bool closed;
     hmm_v2 verts[PHX_TERRAIN_MAX_VERTS];
     material mat;
 } terrain_data;
 
+// Save file records from before polygons, always triangles.
+typedef struct {
+    size_t vert_count;
+    hmm_v2 verts[3];
+    material mat;
+} terrain_data_v1;
+
+#define PICK_RADIUS 6.0f
+#define DRAG_DISTANCE 4.0f
+#define SELECTION_COLOR ((mu_Color){255, 200, 0, 255})
+
+// Terrain segments live in one contiguous range of the gfx shape buffer,
+// the draft's segments always come after all of them.
 typedef struct {
     material mat;
     phx_handle phx;
+    size_t shape_first;
+    size_t shape_count;
 } terrain_handle;
 
 static struct {
     material terrain_material;
     terrain_handle *terrain;
+    size_t shape_count;
+    terrain_data draft;
+    phx_handle *selection;
 } world;
 
-static void terrain_append(terrain_data data) {
-    phx_handle phx = phx_append_terrain(data.verts, data.vert_count);
+static size_t terrain_segment_count(const terrain_data *data) {
+    if (data->vert_count < 2) {
+        return 0;
+    }
+    return data->closed ? data->vert_count : data->vert_count - 1;
+}
+
+// The trace shape buffer has a fixed size and also holds the draft, pieces
+// that don't fit are turned down before physics ever sees them.
+static bool terrain_fits(const terrain_data *data) {
+    return world.shape_count + terrain_segment_count(data) <= GFX_SHAPE_MAX_COUNT;
+}
+
+// Only the outline is traced, never the convex pieces physics uses.
+static size_t terrain_render_outline(const terrain_data *data) {
+    size_t seg_count = terrain_segment_count(data);
+    for (size_t i = 0; i < seg_count; i++) {
+        hmm_v2 a = data->verts[i];
+        hmm_v2 b = data->verts[(i + 1) % data->vert_count];
+        gfx_append_shape(a, b, data->mat);
+    }
+    return seg_count;
+}
+
+static void terrain_render_draft(void) {
+    gfx_truncate_shapes(world.shape_count);
+    if (world.draft.vert_count > 0) {
+        world.draft.mat = world.terrain_material;
+        terrain_render_outline(&world.draft);
+    }
+}
+
+static bool terrain_append(terrain_data data) {
+    if (!terrain_fits(&data)) {
+        printf("terrain: piece needs %zu segments, %zu of %d in use\n",
+               terrain_segment_count(&data),
+               world.shape_count,
+               GFX_SHAPE_MAX_COUNT);
+        return false;
+    }
+    phx_handle phx = phx_append_terrain(data.verts, data.vert_count, data.closed);
+    gfx_truncate_shapes(world.shape_count);
     terrain_handle handle = {
         .phx = phx,
         .mat = data.mat,
+        .shape_first = world.shape_count,
+        .shape_count = terrain_render_outline(&data),
     };
+    world.shape_count += handle.shape_count;
     stbds_arrput(world.terrain, handle);
+    terrain_render_draft();
+    return true;
+}
+
+// world.terrain mirrors phx.terrain, both swap the last piece into the hole.
+static void terrain_remove(phx_handle phx) {
+    size_t index = phx_terrain_index(phx);
+    terrain_handle handle = world.terrain[index];
+    expect(handle.phx.id == phx.id, "terrain index");
+    gfx_remove_shapes(handle.shape_first, handle.shape_count);
+    for (size_t i = 0; i < stbds_arrlenu(world.terrain); i++) {
+        if (world.terrain[i].shape_first > handle.shape_first) {
+            world.terrain[i].shape_first -= handle.shape_count;
+        }
+    }
+    world.shape_count -= handle.shape_count;
+    phx_remove_terrain(phx);
+    stbds_arrdelswap(world.terrain, index);
+    for (size_t i = stbds_arrlenu(world.selection); i > 0; i--) {
+        if (world.selection[i - 1].id == phx.id) {
+            stbds_arrdel(world.selection, i - 1);
+        }
+    }
 }
 
 static void terrain_clear(void) {
     phx_clear_terrain();
+    gfx_clear_shapes();
     stbds_arrsetlen(world.terrain, 0);
+    stbds_arrsetlen(world.selection, 0);
+    world.shape_count = 0;
+    world.draft = (terrain_data){0};
 }
 
-static void terrain_render(void) {
-    for (size_t i = 0; i < stbds_arrlenu(world.terrain); i++) {
-        terrain_handle handle = world.terrain[i];
-        terrain_data data = {
-            .mat = handle.mat,
-        };
-        phx_query_vertices(handle.phx, data.verts, &data.vert_count);
-        for (size_t i = 0; i < data.vert_count; i++) {
-            hmm_v2 a = data.verts[i];
-            hmm_v2 b = data.verts[(i + 1) % data.vert_count];
-            gfx_append_shape(a, b, data.mat);
+static void terrain_collect_func(phx_handle phx, void *data) {
+    phx_handle **handles = data;
+    stbds_arrput(*handles, phx);
+}
+
+static void terrain_select_point(hmm_v2 p) {
+    stbds_arrsetlen(world.selection, 0);
+    phx_handle phx = phx_query_point(p, PICK_RADIUS);
+    if (phx.id) {
+        stbds_arrput(world.selection, phx);
+    }
+}
+
+static void terrain_select_box(hmm_v2 a, hmm_v2 b) {
+    stbds_arrsetlen(world.selection, 0);
+    phx_query_box(HMM_Vec2(HMM_MIN(a.X, b.X), HMM_MIN(a.Y, b.Y)),
+                  HMM_Vec2(HMM_MAX(a.X, b.X), HMM_MAX(a.Y, b.Y)),
+                  terrain_collect_func,
+                  &world.selection);
+}
+
+// terrain_remove() also drops the piece from the selection.
+static void terrain_remove_selection(void) {
+    while (stbds_arrlenu(world.selection) > 0) {
+        terrain_remove(world.selection[0]);
+    }
+}
+
+// Removes everything the stroke from `a` to `b` passes through.
+static void terrain_erase(hmm_v2 a, hmm_v2 b) {
+    phx_handle *hits = NULL;
+    phx_query_segment(a, b, PICK_RADIUS, terrain_collect_func, &hits);
+    for (size_t i = 0; i < stbds_arrlenu(hits); i++) {
+        terrain_remove(hits[i]);
+    }
+    stbds_arrfree(hits);
+}
+
+// Outlines the selected pieces on top of the traced image.
+static void terrain_render_selection(float dpi_scale) {
+    for (size_t i = 0; i < stbds_arrlenu(world.selection); i++) {
+        terrain_handle handle = world.terrain[phx_terrain_index(world.selection[i])];
+        for (size_t j = handle.shape_first; j < handle.shape_first + handle.shape_count; j++) {
+            hmm_v4 v = gfx.trace.fsp.shape_vertices[j];
+            ui_draw_line(v.X / dpi_scale, v.Y / dpi_scale, v.Z / dpi_scale, v.W / dpi_scale, SELECTION_COLOR);
         }
     }
 }
 
+// Left clicks add vertices, clicking the first vertex again closes a
+// polygon, right click ends an open polyline. A draft that runs out of
+// vertices ends as a polyline, one that runs out of trace shapes stops
+// growing.
+static void terrain_draft_point(hmm_v2 p) {
+    terrain_data draft = world.draft;
+    if (draft.vert_count >= 3 && HMM_LengthVec2(HMM_SubtractVec2(p, draft.verts[0])) < CLOSE_DISTANCE) {
+        draft.closed = true;
+    } else {
+        draft.verts[draft.vert_count++] = p;
+    }
+    if (!terrain_fits(&draft)) {
+        printf("terrain: out of trace shapes, finish the piece or remove some\n");
+        return;
+    }
+    if (draft.closed || draft.vert_count == PHX_TERRAIN_MAX_VERTS) {
+        draft.mat = world.terrain_material;
+        world.draft = (terrain_data){0};
+        terrain_append(draft);
+    } else {
+        world.draft = draft;
+        terrain_render_draft();
+    }
+}
+
+static void terrain_draft_finish(void) {
+    terrain_data draft = world.draft;
+    world.draft = (terrain_data){0};
+    if (draft.vert_count >= 2) {
+        draft.closed = false;
+        draft.mat = world.terrain_material;
+        terrain_append(draft);
+    } else {
+        terrain_render_draft();
+    }
+}
+
 static void load(const char *path) {
     FILE *file = fopen(path, "r");
     if (!file) {
         return;
     }
+    char magic[4];
+    if (!fread(magic, sizeof(magic), 1, file) || memcmp(magic, SAVE_MAGIC, 4) != 0) {
+        rewind(file);
+        fread(&world.terrain_material, sizeof(world.terrain_material), 1, file);
+        terrain_data_v1 old;
+        while (fread(&old, sizeof(old), 1, file)) {
+            terrain_data data = {
+                .vert_count = old.vert_count,
+                .closed = true,
+                .verts = {old.verts[0], old.verts[1], old.verts[2]},
+                .mat = old.mat,
+            };
+            terrain_append(data);
+        }
+        fclose(file);
+        return;
+    }
     fread(&world.terrain_material, sizeof(world.terrain_material), 1, file);
     terrain_data data;
     while (fread(&data, sizeof(data), 1, file)) {
@@ -78,18 +265,137 @@ static void save(const char *path) {
     if (!file) {
         return;
     }
+    fwrite(SAVE_MAGIC, 4, 1, file);
     fwrite(&world.terrain_material, sizeof(world.terrain_material), 1, file);
     for (size_t i = 0; i < stbds_arrlenu(world.terrain); i++) {
         terrain_handle handle = world.terrain[i];
         terrain_data data = {
             .mat = handle.mat,
         };
-        phx_query_vertices(handle.phx, data.verts, &data.vert_count);
+        phx_query_vertices(handle.phx, data.verts, &data.vert_count, &data.closed);
         fwrite(&data, sizeof(data), 1, file);
     }
     fclose(file);
 }
 
+// Returns the configured trace variant, applied by the caller so headless
+// runs can read it too.
+static size_t load_config(const char *path) {
+    size_t variant = GFX_TRACE_VARIANT_DEFAULT;
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return variant;
+    }
+    char key[64];
+    char value[64];
+    while (fscanf(file, "%63s %63s", key, value) == 2) {
+        if (strcmp(key, "trace") == 0) {
+            for (size_t i = 0; i < GFX_TRACE_VARIANT_COUNT; i++) {
+                if (strcmp(value, gfx_trace_variants[i].name) == 0) {
+                    variant = i;
+                }
+            }
+        }
+    }
+    fclose(file);
+    return variant;
+}
+
+static void save_config(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return;
+    }
+    fprintf(file, "trace %s\n", gfx_trace_variants[gfx.trace.variant].name);
+    fclose(file);
+}
+
+static void checkpoint_load(const char *path) {
+    ckpt c;
+    if (!ckpt_read(path, &c)) {
+        printf("checkpoint: cannot read %s\n", path);
+        return;
+    }
+    if (gfx_resume_checkpoint(&c)) {
+        printf("checkpoint: resumed %s at %llu samples\n", path, (unsigned long long)c.sample_count);
+    } else {
+        printf("checkpoint: %s does not match the current scene\n", path);
+    }
+    ckpt_free(&c);
+}
+
+static void checkpoint_poll(const char *path) {
+    ckpt c;
+    if (!gfx_poll_checkpoint(&c)) {
+        return;
+    }
+    if (ckpt_write(path, &c)) {
+        printf("checkpoint: wrote %s at %llu samples\n", path, (unsigned long long)c.sample_count);
+    } else {
+        printf("checkpoint: cannot write %s\n", path);
+    }
+}
+
+static int checkpoint_merge(const char *out_path, char **in_paths, int in_count) {
+    ckpt acc = {0};
+    for (int i = 0; i < in_count; i++) {
+        ckpt c;
+        if (!ckpt_read(in_paths[i], &c)) {
+            printf("checkpoint: cannot read %s\n", in_paths[i]);
+            ckpt_free(&acc);
+            return 1;
+        }
+        if (i == 0) {
+            acc = c;
+            continue;
+        }
+        bool ok = ckpt_merge(&acc, &c);
+        ckpt_free(&c);
+        if (!ok) {
+            printf("checkpoint: %s does not match %s\n", in_paths[i], in_paths[0]);
+            ckpt_free(&acc);
+            return 1;
+        }
+    }
+    bool ok = ckpt_write(out_path, &acc);
+    if (ok) {
+        printf("checkpoint: wrote %s at %llu samples\n", out_path, (unsigned long long)acc.sample_count);
+    }
+    ckpt_free(&acc);
+    return ok ? 0 : 1;
+}
+
+// Headless, builds the trace shapes through the same path as the game and
+// renders with the configured trace variant, so the game can resume from the
+// result when both match.
+// Usage: --farm-coordinator scene out.pfm width height samples port [local workers]
+static int farm_render(int argc, char **argv) {
+    phx_create();
+    load(argv[2]);
+    size_t variant = load_config(CONFIG_FILE);
+    farm_desc desc = {
+        .self_path = argv[0],
+        .out_path = argv[3],
+        .width = atoi(argv[4]),
+        .height = atoi(argv[5]),
+        .samples = strtoull(argv[6], NULL, 10),
+        .port = argv[7],
+        .local_workers = argc >= 9 ? atoi(argv[8]) : 0,
+        .batch_samples = 8,
+        .scene =
+            {
+                .vertices = gfx.trace.fsp.shape_vertices,
+                .materials = gfx.trace.fsp.shape_materials,
+                .count = gfx.trace.fsp.shape_count,
+            },
+        .variant = variant,
+        .scene_hash = gfx_trace_hash(gfx_scene_hash(), variant),
+    };
+    int res = farm_coordinate(&desc);
+    phx_destroy();
+    return res;
+}
+
 static void init(void) {
     world.terrain_material = (material){
         .type = MAT_DIFFUSE,
@@ -100,7 +406,26 @@ static void init(void) {
     gfx_setup();
     ui_setup();
     phx_create();
-    load(SAVE_FILE);
+    bool session_ok = rec_begin_session(sapp_width(), sapp_height(), sapp_dpi_scale());
+    expect(session_ok, "cannot start recording session");
+
+    // Recordings carry their own starting level and settings so replays are
+    // deterministic.
+    char rec_world[sizeof(rec.path) + 8];
+    char rec_config[sizeof(rec.path) + 8];
+    snprintf(rec_world, sizeof(rec_world), "%s.data", rec.path);
+    snprintf(rec_config, sizeof(rec_config), "%s.config", rec.path);
+    if (rec.mode == REC_REPLAY) {
+        gfx_set_trace_variant(load_config(rec_config));
+        load(rec_world);
+    } else {
+        gfx_set_trace_variant(load_config(CONFIG_FILE));
+        load(SAVE_FILE);
+    }
+    if (rec.mode == REC_RECORD) {
+        save_config(rec_config);
+        save(rec_world);
+    }
 }
 
 static double get_frame_time(void) {
@@ -108,9 +433,9 @@ static double get_frame_time(void) {
     return stm_ms(stm_laptime(&last_time));
 }
 
-static const char *get_frame_time_str(void) {
+static const char *get_frame_time_str(double frame_ms) {
     static char b[64];
-    snprintf(b, sizeof(b), "%.2lf ms", get_frame_time());
+    snprintf(b, sizeof(b), "%.2lf ms", frame_ms);
     return b;
 }
 
@@ -127,11 +452,63 @@ static const char *get_material_str(void) {
     }
 }
 
-static void hud_render(void) {
+static const char *get_accel_str(void) {
+    return gfx.sdf.enabled ? "A: Distance field" : "A: Off";
+}
+
+// Variants come in pairs, without and with Russian roulette. The roulette
+// variant of a pair also traces deeper.
+static void hud_trace_variant(void) {
+    size_t variant = gfx.trace.variant;
+    int roulette = gfx_trace_variants[variant].roulette;
+    char label[64];
+    snprintf(label,
+             sizeof(label),
+             "%s, %d bounces",
+             gfx_trace_variants[variant].label,
+             gfx_trace_variants[variant].bounce_count);
+    if (mu_button(&ui.ctx, label)) {
+        variant = (variant + 2) % GFX_TRACE_VARIANT_COUNT;
+    }
+    if (mu_checkbox(&ui.ctx, "Roulette", &roulette)) {
+        variant ^= 1;
+    }
+    if (variant != gfx.trace.variant) {
+        gfx_set_trace_variant(variant);
+    }
+}
+
+static const char *get_shape_count_str(void) {
+    static char b[64];
+    snprintf(b, sizeof(b), "%zu phx / %zu seg", phx_query_shape_count(), (size_t)gfx.trace.fsp.shape_count);
+    return b;
+}
+
+static const char *get_alloc_str(void) {
+    static char b[64];
+    snprintf(b, sizeof(b),
+             "Heap: %llu/frame, %llu total",
+             (unsigned long long)mem.last_frame.allocs,
+             (unsigned long long)mem_total.allocs);
+    return b;
+}
+
+static const char *get_selection_str(void) {
+    static char b[64];
+    snprintf(b, sizeof(b), "Selected: %zu", stbds_arrlenu(world.selection));
+    return b;
+}
+
+static void hud_render(double frame_ms) {
     mu_begin(&ui.ctx);
-    if (mu_begin_window_ex(&ui.ctx, "", mu_rect(10, 10, 200, 200), MU_OPT_NOFRAME | MU_OPT_NOTITLE)) {
-        mu_label(&ui.ctx, get_frame_time_str());
+    if (mu_begin_window_ex(&ui.ctx, "", mu_rect(10, 10, 200, 320), MU_OPT_NOFRAME | MU_OPT_NOTITLE)) {
+        mu_label(&ui.ctx, get_frame_time_str(frame_ms));
+        mu_label(&ui.ctx, get_alloc_str());
         mu_label(&ui.ctx, get_material_str());
+        mu_label(&ui.ctx, get_accel_str());
+        mu_label(&ui.ctx, get_shape_count_str());
+        mu_label(&ui.ctx, get_selection_str());
+        hud_trace_variant();
         mu_slider(&ui.ctx, &world.terrain_material.color.R, 0.0f, 1.0f);
         mu_slider(&ui.ctx, &world.terrain_material.color.G, 0.0f, 1.0f);
         mu_slider(&ui.ctx, &world.terrain_material.color.B, 0.0f, 1.0f);
@@ -148,16 +525,33 @@ static void hud_render(void) {
     mu_end(&ui.ctx);
 }
 
+static void handle_event(const sapp_event *event);
+
+// Input handled since the last frame began, frames without any are expected
+// not to allocate.
+static size_t frame_events;
+
 static void frame(void) {
+    mem_next_frame(frame_events == 0);
+    frame_events = 0;
+
     int width = sapp_width();
     int height = sapp_height();
     int dpi_scale = sapp_dpi_scale();
+    double frame_ms = get_frame_time();
+    uint64_t body_start = stm_now();
 
+    if (!rec_begin_frame(handle_event)) {
+        sapp_quit();
+    }
     phx_simulate();
-    hud_render();
-    gfx_clear_shapes();
-    terrain_render();
-    gfx_render(width, height, dpi_scale);
+    hud_render(frame_ms);
+    terrain_render_draft();
+    terrain_render_selection(dpi_scale);
+    gfx_render(width, height, dpi_scale, rec_time(stm_sec(stm_now())));
+    double body_ms = stm_ms(stm_since(body_start));
+    checkpoint_poll(CHECKPOINT_FILE);
+    rec_end_frame(body_ms);
 }
 
 static bool mouse_buttons[] = {
@@ -166,30 +560,44 @@ static bool mouse_buttons[] = {
     [SAPP_MOUSEBUTTON_MIDDLE] = false,
 };
 
+// Every press is tracked, presses on the HUD belong to the HUD and their
+// release does nothing in the world.
+static hmm_v2 mouse_down_pos;
+static bool mouse_down_in_world;
+
 static void on_mouse_down(const sapp_event *event) {
     mouse_buttons[event->mouse_button] = true;
 
-    float x = event->mouse_x / sapp_dpi_scale();
-    float y = event->mouse_y / sapp_dpi_scale();
-    (void)x;
-    (void)y;
+    float x = event->mouse_x; // / sapp_dpi_scale();
+    float y = event->mouse_y; // / sapp_dpi_scale();
+    mouse_down_pos = HMM_Vec2(x, y);
+    mouse_down_in_world = !ui_is_hovered();
 }
 
 static void on_mouse_up(const sapp_event *event) {
     mouse_buttons[event->mouse_button] = false;
+    if (!mouse_down_in_world) {
+        return;
+    }
 
     float x = event->mouse_x; // / sapp_dpi_scale();
     float y = event->mouse_y; // / sapp_dpi_scale();
-    static terrain_data ter;
-
-    if (event->mouse_button == SAPP_MOUSEBUTTON_LEFT) {
-        ter.verts[ter.vert_count] = HMM_Vec2(x, y);
-        ter.vert_count++;
-        if (ter.vert_count == 3) {
-            ter.vert_count = 0;
-            ter.mat = world.terrain_material;
-            terrain_append(ter);
+
+    hmm_v2 p = HMM_Vec2(x, y);
+    bool dragged = HMM_LengthVec2(HMM_SubtractVec2(p, mouse_down_pos)) > DRAG_DISTANCE;
+
+    if (event->mouse_button == SAPP_MOUSEBUTTON_LEFT && (event->modifiers & SAPP_MODIFIER_SHIFT)) {
+        if (dragged) {
+            terrain_select_box(mouse_down_pos, p);
+        } else {
+            terrain_select_point(p);
         }
+    } else if (event->mouse_button == SAPP_MOUSEBUTTON_LEFT && (event->modifiers & SAPP_MODIFIER_ALT)) {
+        terrain_erase(mouse_down_pos, p);
+    } else if (event->mouse_button == SAPP_MOUSEBUTTON_LEFT) {
+        terrain_draft_point(p);
+    } else if (event->mouse_button == SAPP_MOUSEBUTTON_RIGHT) {
+        terrain_draft_finish();
     }
 }
 
@@ -211,6 +619,19 @@ static void on_key_up(const sapp_event *event) {
     case SAPP_KEYCODE_C:
         terrain_clear();
         break;
+    case SAPP_KEYCODE_DELETE:
+    case SAPP_KEYCODE_BACKSPACE:
+        terrain_remove_selection();
+        break;
+    case SAPP_KEYCODE_A:
+        gfx_set_accel(!gfx.sdf.enabled);
+        break;
+    case SAPP_KEYCODE_K:
+        gfx_request_checkpoint();
+        break;
+    case SAPP_KEYCODE_L:
+        checkpoint_load(CHECKPOINT_FILE);
+        break;
     default:
         break;
     }
@@ -232,7 +653,8 @@ static void on_key_down(const sapp_event *event) {
     }
 }
 
-static void event(const sapp_event *event) {
+static void handle_event(const sapp_event *event) {
+    frame_events++;
     ui_event(event);
     switch (event->type) {
     case SAPP_EVENTTYPE_MOUSE_MOVE:
@@ -241,9 +663,7 @@ static void event(const sapp_event *event) {
         }
         break;
     case SAPP_EVENTTYPE_MOUSE_DOWN:
-        if (!ui_is_hovered()) {
-            on_mouse_down(event);
-        }
+        on_mouse_down(event);
         break;
     case SAPP_EVENTTYPE_MOUSE_UP:
         if (!ui_is_hovered()) {
@@ -261,16 +681,48 @@ static void event(const sapp_event *event) {
     }
 }
 
+static void event(const sapp_event *event) {
+    if (rec.mode == REC_REPLAY) {
+        return;
+    }
+    rec_capture(event);
+    handle_event(event);
+}
+
 static void cleanup(void) {
-    save(SAVE_FILE);
+    if (rec.mode != REC_REPLAY) {
+        save(SAVE_FILE);
+        save_config(CONFIG_FILE);
+    }
+    rec_finish();
     phx_destroy();
     ui_shutdown();
     gfx_shutdown();
 }
 
 sapp_desc sokol_main(int argc, char *argv[]) {
-    (void)(argc);
-    (void)(argv);
+    // Before anything else, headless modes use the frame arena too.
+    mem_setup();
+    if (argc >= 4 && strcmp(argv[1], "--merge") == 0) {
+        exit(checkpoint_merge(argv[2], &argv[3], argc - 3));
+    }
+    if (argc >= 8 && strcmp(argv[1], "--farm-coordinator") == 0) {
+        exit(farm_render(argc, argv));
+    }
+    if (argc >= 4 && strcmp(argv[1], "--farm-worker") == 0) {
+        exit(farm_work(argv[2], argv[3]));
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--assert-no-alloc") == 0) {
+            mem.assert_steady = true;
+        }
+    }
+    if (argc >= 3 && strcmp(argv[1], "--record") == 0) {
+        rec_start_recording(argv[2]);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--replay") == 0) {
+        expect(rec_start_replay(argv[2]), "cannot read recording");
+    }
     return (sapp_desc){
         .init_cb = init,
         .frame_cb = frame,
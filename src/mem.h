@@ -0,0 +1,184 @@
+#ifndef INCLUDE_MEM
+#define INCLUDE_MEM
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+#ifdef INCLUDE_STB_DS_H
+#error "mem.h must be included before stb_ds.h"
+#endif
+
+#define MEM_ALIGN 16
+#define MEM_FRAME_ARENA_SIZE (1 << 20)
+#define MEM_WARMUP_FRAMES 2
+
+// All heap traffic of this code base goes through mem_heap_*, stb_ds arrays
+// included. Allocations made inside Chipmunk and sokol are not counted.
+typedef struct {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t bytes;
+} mem_counters;
+
+extern mem_counters mem_total;
+extern mem_counters mem_frame;
+
+void *mem_heap_alloc(size_t size);
+void *mem_heap_realloc(void *ptr, size_t size);
+void mem_heap_free(void *ptr);
+
+// Must come before the first stb_ds.h include, so every array is counted.
+#define STBDS_REALLOC(context, ptr, size) mem_heap_realloc(ptr, size)
+#define STBDS_FREE(context, ptr) mem_heap_free(ptr)
+
+#ifdef MEM_IMPL
+mem_counters mem_total;
+mem_counters mem_frame;
+
+static void mem_count_alloc(size_t size) {
+    mem_total.allocs++;
+    mem_total.bytes += size;
+    mem_frame.allocs++;
+    mem_frame.bytes += size;
+}
+
+void *mem_heap_alloc(size_t size) {
+    mem_count_alloc(size);
+    return malloc(size);
+}
+
+void *mem_heap_realloc(void *ptr, size_t size) {
+    if (size > 0) {
+        mem_count_alloc(size);
+    }
+    return realloc(ptr, size);
+}
+
+void mem_heap_free(void *ptr) {
+    if (ptr) {
+        mem_total.frees++;
+        mem_frame.frees++;
+    }
+    free(ptr);
+}
+#endif
+
+static size_t mem_align(size_t size) {
+    return (size + MEM_ALIGN - 1) & ~(size_t)(MEM_ALIGN - 1);
+}
+
+// Linear arena for scratch memory, everything is dropped when the next
+// frame begins.
+static struct {
+    uint8_t *arena;
+    size_t arena_used;
+    mem_counters last_frame;
+    uint64_t frame_index;
+    bool assert_steady;
+} mem;
+
+// Allocates the frame arena up front, so that its first use can't count
+// against a frame without input.
+static void mem_setup(void) {
+    if (!mem.arena) {
+        mem.arena = mem_heap_alloc(MEM_FRAME_ARENA_SIZE);
+        expect(mem.arena != NULL, "cannot allocate frame arena");
+    }
+}
+
+static void *mem_frame_alloc(size_t size) {
+    expect(mem.arena != NULL, "mem_setup() not called");
+    size = mem_align(size);
+    expect(mem.arena_used + size <= MEM_FRAME_ARENA_SIZE, "frame arena exhausted");
+    void *ptr = &mem.arena[mem.arena_used];
+    mem.arena_used += size;
+    return ptr;
+}
+
+// Scratch users that may run many times per frame, like level loading,
+// give their memory back early.
+static size_t mem_frame_mark(void) {
+    return mem.arena_used;
+}
+
+static void mem_frame_release(size_t mark) {
+    mem.arena_used = mark;
+}
+
+// Closes the previous frame. With assert_steady set, a frame without input
+// that still touched the heap is fatal.
+static void mem_next_frame(bool steady) {
+    if (mem.assert_steady && steady && mem.frame_index > MEM_WARMUP_FRAMES && mem_frame.allocs > 0) {
+        fprintf(stderr,
+                "mem: steady frame %llu made %llu allocations (%llu bytes)\n",
+                (unsigned long long)mem.frame_index,
+                (unsigned long long)mem_frame.allocs,
+                (unsigned long long)mem_frame.bytes);
+        expect(false, "heap allocation in steady-state frame");
+    }
+    mem.last_frame = mem_frame;
+    mem_frame = (mem_counters){0};
+    mem.arena_used = 0;
+    mem.frame_index++;
+}
+
+// Fixed-size free-list allocator, grows by whole chunks and never returns
+// memory to the heap until destroyed.
+typedef struct mem_pool_link {
+    struct mem_pool_link *next;
+} mem_pool_link;
+
+typedef struct {
+    size_t item_size;
+    size_t chunk_items;
+    mem_pool_link *chunks;
+    mem_pool_link *free_items;
+} mem_pool;
+
+static mem_pool mem_pool_make(size_t item_size, size_t chunk_items) {
+    return (mem_pool){
+        .item_size = mem_align(item_size > sizeof(mem_pool_link) ? item_size : sizeof(mem_pool_link)),
+        .chunk_items = chunk_items,
+    };
+}
+
+static void *mem_pool_alloc(mem_pool *pool) {
+    if (!pool->free_items) {
+        size_t header = mem_align(sizeof(mem_pool_link));
+        uint8_t *chunk = mem_heap_alloc(header + pool->item_size * pool->chunk_items);
+        ((mem_pool_link *)chunk)->next = pool->chunks;
+        pool->chunks = (mem_pool_link *)chunk;
+        for (size_t i = pool->chunk_items; i > 0; i--) {
+            mem_pool_link *item = (mem_pool_link *)(chunk + header + pool->item_size * (i - 1));
+            item->next = pool->free_items;
+            pool->free_items = item;
+        }
+    }
+    mem_pool_link *item = pool->free_items;
+    pool->free_items = item->next;
+    memset(item, 0, pool->item_size);
+    return item;
+}
+
+static void mem_pool_free(mem_pool *pool, void *ptr) {
+    mem_pool_link *item = ptr;
+    item->next = pool->free_items;
+    pool->free_items = item;
+}
+
+static void mem_pool_destroy(mem_pool *pool) {
+    while (pool->chunks) {
+        mem_pool_link *next = pool->chunks->next;
+        mem_heap_free(pool->chunks);
+        pool->chunks = next;
+    }
+    pool->free_items = NULL;
+}
+
+#endif
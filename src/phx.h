@@ -1,6 +1,8 @@
 #ifndef INCLUDE_PHX
 #define INCLUDE_PHX
 
+#include "mem.h"
+
 #define STBDS_NO_SHORT_NAMES
 #include <vendor/stb/stb_ds.h>
 
@@ -8,18 +10,44 @@
 #include <vendor/Handmade-Math/HandmadeMath.h>
 
 #include <chipmunk/chipmunk.h>
+#include <chipmunk/chipmunk_structs.h>
+#include <chipmunk/cpPolyline.h>
 
 #include "utils.h"
 
-#define PHX_TERRAIN_MAX_VERTS 3
+#define PHX_TERRAIN_MAX_VERTS 64
+#define PHX_DECOMPOSITION_TOL 0.5f
+#define PHX_SEGMENT_RADIUS 1.0f
+#define PHX_TERRAIN_MAX_SHAPES PHX_TERRAIN_MAX_VERTS
+#define PHX_POOL_CHUNK_ITEMS 256
 
 typedef struct {
     void *id;
 } phx_handle;
 
+// A piece of terrain is either a closed polygon, split into convex polys
+// for Chipmunk, or an open polyline made of segment shapes. The outline is
+// kept as given, that's what gets traced.
+typedef struct {
+    cpShape *shapes[PHX_TERRAIN_MAX_SHAPES];
+    size_t shape_count;
+    size_t index;
+    uint32_t query_stamp;
+    size_t vert_count;
+    bool closed;
+    hmm_v2 verts[PHX_TERRAIN_MAX_VERTS];
+} phx_terrain;
+
+typedef void (*phx_terrain_func)(phx_handle handle, void *data);
+
 static struct {
     cpSpace *space;
-    cpShape **terrain_shapes;
+    phx_terrain **terrain;
+    mem_pool terrain_pool;
+    mem_pool shape_pool;
+    uint32_t query_stamp;
+    phx_terrain_func query_func;
+    void *query_data;
 } phx;
 
 static void phx_create(void) {
@@ -27,41 +55,198 @@ static void phx_create(void) {
     expect(phx.space, "phx.space");
     cpSpaceSetIterations(phx.space, 30);
     cpSpaceSetGravity(phx.space, cpv(0.0, 10.0));
+    phx.terrain_pool = mem_pool_make(sizeof(phx_terrain), PHX_POOL_CHUNK_ITEMS);
+    size_t shape_size = HMM_MAX(sizeof(cpPolyShape), sizeof(cpSegmentShape));
+    phx.shape_pool = mem_pool_make(shape_size, PHX_POOL_CHUNK_ITEMS);
+}
+
+// Terrain shapes come from our pool through the cp*ShapeInit() calls rather
+// than Chipmunk's own malloc, so they're released with cpShapeDestroy().
+static cpShape *phx_new_poly(cpBody *body, int count, const cpVect *verts) {
+    cpPolyShape *poly = mem_pool_alloc(&phx.shape_pool);
+    return (cpShape *)cpPolyShapeInit(poly, body, count, verts, cpTransformIdentity, 0.0f);
+}
+
+static cpShape *phx_new_segment(cpBody *body, cpVect a, cpVect b) {
+    cpSegmentShape *seg = mem_pool_alloc(&phx.shape_pool);
+    return (cpShape *)cpSegmentShapeInit(seg, body, a, b, PHX_SEGMENT_RADIUS);
+}
+
+static void phx_free_shape(cpShape *shape) {
+    cpSpaceRemoveShape(phx.space, shape);
+    cpShapeDestroy(shape);
+    mem_pool_free(&phx.shape_pool, shape);
+}
+
+static void phx_add_shape(phx_terrain *ter, cpShape *shape) {
+    expect(ter->shape_count < PHX_TERRAIN_MAX_SHAPES, "max terrain shapes");
+    cpShapeSetUserData(shape, ter);
+    cpSpaceAddShape(phx.space, shape);
+    ter->shapes[ter->shape_count++] = shape;
+}
+
+static void phx_add_polygon(phx_terrain *ter, const cpVect *verts, int count) {
+    cpBody *body = cpSpaceGetStaticBody(phx.space);
+    size_t mark = mem_frame_mark();
+
+    // Closed and counter-clockwise, as cpPolylineConvexDecomposition() wants.
+    cpPolyline *line = mem_frame_alloc(sizeof(cpPolyline) + sizeof(cpVect) * (count + 1));
+    line->count = count + 1;
+    line->capacity = count + 1;
+    bool reverse = cpAreaForPoly(count, verts, 0.0f) < 0.0f;
+    for (int i = 0; i < count; i++) {
+        line->verts[i] = verts[reverse ? count - 1 - i : i];
+    }
+    line->verts[count] = line->verts[0];
+
+    cpPolylineSet *set = cpPolylineConvexDecomposition(line, PHX_DECOMPOSITION_TOL);
+    if (set && set->count > 0 && set->count <= PHX_TERRAIN_MAX_SHAPES) {
+        for (int i = 0; i < set->count; i++) {
+            cpPolyline *hull = set->lines[i];
+            int hull_count = cpPolylineIsClosed(hull) ? hull->count - 1 : hull->count;
+            phx_add_shape(ter, phx_new_poly(body, hull_count, hull->verts));
+        }
+    } else {
+        phx_add_shape(ter, phx_new_poly(body, count, verts));
+    }
+    if (set) {
+        cpPolylineSetFree(set, true);
+    }
+    mem_frame_release(mark);
 }
 
-static phx_handle phx_append_terrain(const hmm_v2 *verts, size_t count) {
+static void phx_add_polyline(phx_terrain *ter, const cpVect *verts, int count) {
+    cpBody *body = cpSpaceGetStaticBody(phx.space);
+    for (int i = 0; i + 1 < count; i++) {
+        cpShape *shape = phx_new_segment(body, verts[i], verts[i + 1]);
+        cpSegmentShapeSetNeighbors(
+            shape, verts[i > 0 ? i - 1 : i], verts[i + 2 < count ? i + 2 : i + 1]);
+        phx_add_shape(ter, shape);
+    }
+}
+
+static phx_handle phx_append_terrain(const hmm_v2 *verts, size_t count, bool closed) {
+    expect(count <= PHX_TERRAIN_MAX_VERTS, "max terrain verts");
+    phx_terrain *ter = mem_pool_alloc(&phx.terrain_pool);
     cpVect cpverts[PHX_TERRAIN_MAX_VERTS];
     for (size_t i = 0; i < count; i++) {
         cpverts[i] = cpv(verts[i].X, verts[i].Y);
+        ter->verts[i] = verts[i];
     }
-    cpBody *body = cpSpaceGetStaticBody(phx.space);
-    cpShape *shape = cpPolyShapeNew(body, count, cpverts, cpTransformIdentity, 0.0f);
-    cpSpaceAddShape(phx.space, shape);
-    stbds_arrput(phx.terrain_shapes, shape);
-    return (phx_handle){shape};
+    ter->vert_count = count;
+    ter->closed = closed && count >= 3;
+    if (ter->closed) {
+        phx_add_polygon(ter, cpverts, (int)count);
+    } else {
+        phx_add_polyline(ter, cpverts, (int)count);
+    }
+    ter->index = stbds_arrlenu(phx.terrain);
+    stbds_arrput(phx.terrain, ter);
+    return (phx_handle){ter};
+}
+
+static void phx_free_terrain(phx_terrain *ter) {
+    for (size_t i = 0; i < ter->shape_count; i++) {
+        phx_free_shape(ter->shapes[i]);
+    }
+    mem_pool_free(&phx.terrain_pool, ter);
+}
+
+// Swaps the last terrain into the removed one's place, same as
+// stbds_arrdelswap() on a parallel array.
+static void phx_remove_terrain(phx_handle sh) {
+    phx_terrain *ter = sh.id;
+    size_t index = ter->index;
+    stbds_arrdelswap(phx.terrain, index);
+    if (index < stbds_arrlenu(phx.terrain)) {
+        phx.terrain[index]->index = index;
+    }
+    phx_free_terrain(ter);
+}
+
+static size_t phx_terrain_index(phx_handle sh) {
+    const phx_terrain *ter = sh.id;
+    return ter->index;
 }
 
 static void phx_clear_terrain(void) {
-    while (stbds_arrlenu(phx.terrain_shapes) > 0) {
-        cpShape *shape = stbds_arrpop(phx.terrain_shapes);
-        cpSpaceRemoveShape(phx.space, shape);
-        cpShapeFree(shape);
+    while (stbds_arrlenu(phx.terrain) > 0) {
+        phx_free_terrain(stbds_arrpop(phx.terrain));
     }
 }
 
-static void phx_query_vertices(phx_handle sh, hmm_v2 *verts, size_t *vert_count) {
-    int count = cpPolyShapeGetCount(sh.id);
-    if (count < 0) {
-        count = 0;
+static void phx_query_vertices(phx_handle sh, hmm_v2 *verts, size_t *vert_count, bool *closed) {
+    const phx_terrain *ter = sh.id;
+    for (size_t i = 0; i < ter->vert_count; i++) {
+        verts[i] = ter->verts[i];
     }
-    for (int i = 0; i < count; i++) {
-        cpVect v = cpPolyShapeGetVert(sh.id, i);
-        verts[i] = HMM_Vec2(v.x, v.y);
+    *vert_count = ter->vert_count;
+    *closed = ter->closed;
+}
+
+static size_t phx_query_shape_count(void) {
+    size_t count = 0;
+    for (size_t i = 0; i < stbds_arrlenu(phx.terrain); i++) {
+        count += phx.terrain[i]->shape_count;
     }
-    *vert_count = (size_t)count;
+    return count;
+}
+
+// Queries go through Chipmunk's spatial index and report every terrain
+// piece once, even when several of its shapes match.
+static void phx_query_report(cpShape *shape) {
+    phx_terrain *ter = cpShapeGetUserData(shape);
+    if (!ter || ter->query_stamp == phx.query_stamp) {
+        return;
+    }
+    ter->query_stamp = phx.query_stamp;
+    phx.query_func((phx_handle){ter}, phx.query_data);
+}
+
+static void phx_query_begin(phx_terrain_func func, void *data) {
+    phx.query_stamp++;
+    phx.query_func = func;
+    phx.query_data = data;
+}
+
+static void phx_segment_query_func(cpShape *shape, cpVect point, cpVect normal, cpFloat alpha, void *data) {
+    (void)point;
+    (void)normal;
+    (void)alpha;
+    (void)data;
+    phx_query_report(shape);
+}
+
+static void phx_bb_query_func(cpShape *shape, void *data) {
+    (void)data;
+    phx_query_report(shape);
+}
+
+// Returns the terrain closest to `p` within `radius`, or a null handle.
+static phx_handle phx_query_point(hmm_v2 p, float radius) {
+    cpPointQueryInfo info;
+    cpShape *shape = cpSpacePointQueryNearest(phx.space, cpv(p.X, p.Y), radius, CP_SHAPE_FILTER_ALL, &info);
+    return (phx_handle){shape ? cpShapeGetUserData(shape) : NULL};
+}
+
+static void phx_query_segment(hmm_v2 a, hmm_v2 b, float radius, phx_terrain_func func, void *data) {
+    phx_query_begin(func, data);
+    cpSpaceSegmentQuery(
+        phx.space, cpv(a.X, a.Y), cpv(b.X, b.Y), radius, CP_SHAPE_FILTER_ALL, phx_segment_query_func, NULL);
+}
+
+// Matches terrain whose shapes' bounding boxes overlap the box.
+static void phx_query_box(hmm_v2 min, hmm_v2 max, phx_terrain_func func, void *data) {
+    phx_query_begin(func, data);
+    cpSpaceBBQuery(
+        phx.space, cpBBNew(min.X, min.Y, max.X, max.Y), CP_SHAPE_FILTER_ALL, phx_bb_query_func, NULL);
 }
 
 static void phx_destroy(void) {
+    phx_clear_terrain();
+    stbds_arrfree(phx.terrain);
+    mem_pool_destroy(&phx.shape_pool);
+    mem_pool_destroy(&phx.terrain_pool);
     cpSpaceFree(phx.space);
 }
 
@@ -0,0 +1,266 @@
+#ifndef INCLUDE_REC
+#define INCLUDE_REC
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+
+#define STBDS_NO_SHORT_NAMES
+#include <vendor/stb/stb_ds.h>
+
+#define SOKOL_METAL
+#include <vendor/sokol/sokol_app.h>
+
+#include "utils.h"
+
+#define REC_MAGIC "LREC"
+#define REC_VERSION 2
+#define REC_SEED 1
+#define REC_FRAME_DT (1.0 / 60.0)
+
+typedef enum {
+    REC_OFF = 0,
+    REC_RECORD = 1,
+    REC_REPLAY = 2,
+} rec_mode;
+
+// Written at the start of a recording. Events carry framebuffer pixel
+// coordinates, so they only replay correctly on a matching display.
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t seed;
+    int32_t width;
+    int32_t height;
+    float dpi_scale;
+} rec_header;
+
+// On-disk event, frame is the number of frames completed before the event
+// arrived. Events follow the header until the end of the file, flushed after
+// every frame. A trailing SAPP_EVENTTYPE_INVALID event marks the session end,
+// recordings cut short by a crash end after their last event.
+typedef struct {
+    uint32_t frame;
+    uint8_t type;
+    uint8_t mouse_button;
+    uint16_t key_code;
+    uint32_t char_code;
+    uint32_t modifiers;
+    float mouse_x;
+    float mouse_y;
+    float scroll_x;
+    float scroll_y;
+} rec_event;
+
+typedef void (*rec_event_func)(const sapp_event *event);
+
+static struct {
+    rec_mode mode;
+    char path[256];
+    FILE *file;
+    rec_header header;
+    uint32_t frame;
+    size_t cursor;
+    size_t unflushed;
+    bool finished;
+    rec_event *events;
+    double *frame_times;
+} rec;
+
+static void rec_start_recording(const char *path) {
+    rec.mode = REC_RECORD;
+    snprintf(rec.path, sizeof(rec.path), "%s", path);
+}
+
+static bool rec_start_replay(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fread(&rec.header, sizeof(rec.header), 1, file) &&
+              memcmp(rec.header.magic, REC_MAGIC, 4) == 0 && rec.header.version == REC_VERSION;
+    rec_event ev;
+    while (ok && fread(&ev, sizeof(ev), 1, file)) {
+        stbds_arrput(rec.events, ev);
+    }
+    fclose(file);
+    if (!ok || stbds_arrlenu(rec.events) == 0) {
+        stbds_arrfree(rec.events);
+        return false;
+    }
+    if (stbds_arrlast(rec.events).type != SAPP_EVENTTYPE_INVALID) {
+        rec_event end = {.frame = stbds_arrlast(rec.events).frame + 1, .type = SAPP_EVENTTYPE_INVALID};
+        stbds_arrput(rec.events, end);
+    }
+    // Timings are kept for every frame, reserve up front so replayed
+    // frames don't allocate.
+    stbds_arrsetcap(rec.frame_times, stbds_arrlast(rec.events).frame + 1);
+    rec.mode = REC_REPLAY;
+    snprintf(rec.path, sizeof(rec.path), "%s", path);
+    return true;
+}
+
+// Called once the display is known. Starts writing a recording, or checks
+// that a replay runs on the display it was recorded on.
+static bool rec_begin_session(int width, int height, float dpi_scale) {
+    if (rec.mode == REC_REPLAY) {
+        if (rec.header.width != width || rec.header.height != height || rec.header.dpi_scale != dpi_scale) {
+            printf("replay: recorded at %dx%d scale %.2f, display is %dx%d scale %.2f\n",
+                   rec.header.width,
+                   rec.header.height,
+                   rec.header.dpi_scale,
+                   width,
+                   height,
+                   dpi_scale);
+            return false;
+        }
+        return true;
+    }
+    if (rec.mode != REC_RECORD) {
+        return true;
+    }
+    rec.header = (rec_header){
+        .magic = REC_MAGIC,
+        .version = REC_VERSION,
+        .seed = REC_SEED,
+        .width = width,
+        .height = height,
+        .dpi_scale = dpi_scale,
+    };
+    rec.file = fopen(rec.path, "wb");
+    return rec.file && fwrite(&rec.header, sizeof(rec.header), 1, rec.file) && fflush(rec.file) == 0;
+}
+
+static void rec_capture(const sapp_event *event) {
+    if (rec.mode != REC_RECORD || !rec.file) {
+        return;
+    }
+    rec_event ev = {
+        .frame = rec.frame,
+        .type = (uint8_t)event->type,
+        .mouse_button = (uint8_t)event->mouse_button,
+        .key_code = (uint16_t)event->key_code,
+        .char_code = event->char_code,
+        .modifiers = event->modifiers,
+        .mouse_x = event->mouse_x,
+        .mouse_y = event->mouse_y,
+        .scroll_x = event->scroll_x,
+        .scroll_y = event->scroll_y,
+    };
+    fwrite(&ev, sizeof(ev), 1, rec.file);
+    rec.unflushed++;
+}
+
+// Simulation clock, also seeds the trace RNG. Fixed step while replaying.
+static double rec_time(double wall_time) {
+    if (rec.mode != REC_REPLAY) {
+        return wall_time;
+    }
+    return rec.header.seed + rec.frame * REC_FRAME_DT;
+}
+
+// Feeds back the events recorded for the current frame. Returns false once
+// the session is over.
+static bool rec_begin_frame(rec_event_func func) {
+    if (rec.mode != REC_REPLAY) {
+        return true;
+    }
+    if (rec.finished) {
+        return false;
+    }
+    while (rec.cursor < stbds_arrlenu(rec.events)) {
+        rec_event ev = rec.events[rec.cursor];
+        if (ev.frame > rec.frame) {
+            break;
+        }
+        if (ev.type == SAPP_EVENTTYPE_INVALID) {
+            rec.finished = true;
+            return false;
+        }
+        sapp_event event = {
+            .frame_count = ev.frame,
+            .type = (sapp_event_type)ev.type,
+            .mouse_button = (sapp_mousebutton)ev.mouse_button,
+            .key_code = (sapp_keycode)ev.key_code,
+            .char_code = ev.char_code,
+            .modifiers = ev.modifiers,
+            .mouse_x = ev.mouse_x,
+            .mouse_y = ev.mouse_y,
+            .scroll_x = ev.scroll_x,
+            .scroll_y = ev.scroll_y,
+            .window_width = sapp_width(),
+            .window_height = sapp_height(),
+        };
+        func(&event);
+        rec.cursor++;
+    }
+    return true;
+}
+
+// `frame_ms` covers the frame body only, without the wait for the display.
+// The first frame also pays for setup and is left out.
+static void rec_end_frame(double frame_ms) {
+    if (rec.mode == REC_REPLAY && !rec.finished && rec.frame > 0) {
+        stbds_arrput(rec.frame_times, frame_ms);
+    }
+    if (rec.unflushed > 0) {
+        fflush(rec.file);
+        rec.unflushed = 0;
+    }
+    rec.frame++;
+}
+
+static int rec_compare_times(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void rec_report(void) {
+    size_t count = stbds_arrlenu(rec.frame_times);
+    if (count == 0) {
+        return;
+    }
+    char times_path[sizeof(rec.path) + 8];
+    snprintf(times_path, sizeof(times_path), "%s.times", rec.path);
+    FILE *file = fopen(times_path, "w");
+    if (file) {
+        for (size_t i = 0; i < count; i++) {
+            fprintf(file, "%zu %.4f\n", i, rec.frame_times[i]);
+        }
+        fclose(file);
+    }
+
+    double sum = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        sum += rec.frame_times[i];
+    }
+    qsort(rec.frame_times, count, sizeof(double), rec_compare_times);
+    printf("replay: %zu frames, mean %.2f ms, p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+           count,
+           sum / count,
+           rec.frame_times[count * 50 / 100],
+           rec.frame_times[count * 90 / 100],
+           rec.frame_times[count * 99 / 100],
+           rec.frame_times[count - 1]);
+}
+
+static void rec_finish(void) {
+    if (rec.mode == REC_RECORD && rec.file) {
+        rec_event end = {.frame = rec.frame, .type = SAPP_EVENTTYPE_INVALID};
+        fwrite(&end, sizeof(end), 1, rec.file);
+        fclose(rec.file);
+        rec.file = NULL;
+    } else if (rec.mode == REC_REPLAY) {
+        rec_report();
+    }
+    stbds_arrfree(rec.events);
+    stbds_arrfree(rec.frame_times);
+    rec.mode = REC_OFF;
+}
+
+#endif
@@ -0,0 +1,248 @@
+#ifndef INCLUDE_SDF
+#define INCLUDE_SDF
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+
+#define STBDS_NO_SHORT_NAMES
+#include <vendor/stb/stb_ds.h>
+
+#define HANDMADE_MATH_NO_SSE
+#include <vendor/Handmade-Math/HandmadeMath.h>
+
+#define SDF_SIZE 128
+#define SDF_MAX_DIST 8.0f // in cells
+#define SDF_ITEMS_WIDTH 256
+#define SDF_ITEMS_MAX (SDF_ITEMS_WIDTH * SDF_ITEMS_WIDTH)
+
+// Low-resolution distance field over all segments, used by the tracer to
+// skip empty space. Every cell stores a lower bound of the distance from any
+// point inside it to the nearest segment, clamped to SDF_MAX_DIST cells, so
+// a segment only ever touches the cells around it and edits can be rebuilt
+// locally.
+//
+// Cells at distance zero, where the tracer runs exact tests, also list the
+// segments within reach of them as indices into `items`. A count of -1 means
+// the lists ran out of room and the tracer tests every segment there.
+static struct {
+    hmm_v4 domain; // origin.xy, size.zw
+    hmm_v4 *segments;
+    hmm_v4 cells[SDF_SIZE * SDF_SIZE]; // distance, first item, item count
+    float items[SDF_ITEMS_MAX];
+    size_t item_count;
+    bool dirty;
+} sdf;
+
+static float sdf_segment_distance(hmm_v2 p, hmm_v4 s) {
+    hmm_v2 a = s.XY;
+    hmm_v2 ab = HMM_SubtractVec2(s.ZW, a);
+    hmm_v2 ap = HMM_SubtractVec2(p, a);
+    float len2 = HMM_DotVec2(ab, ab);
+    float t = len2 > 0.0f ? HMM_Clamp(0.0f, HMM_DotVec2(ap, ab) / len2, 1.0f) : 0.0f;
+    return HMM_LengthVec2(HMM_SubtractVec2(ap, HMM_MultiplyVec2f(ab, t)));
+}
+
+static hmm_v4 sdf_segment_bounds(hmm_v4 s) {
+    return HMM_Vec4(HMM_MIN(s.X, s.Z), HMM_MIN(s.Y, s.W), HMM_MAX(s.X, s.Z), HMM_MAX(s.Y, s.W));
+}
+
+static hmm_v4 sdf_union(hmm_v4 a, hmm_v4 b) {
+    return HMM_Vec4(HMM_MIN(a.X, b.X), HMM_MIN(a.Y, b.Y), HMM_MAX(a.Z, b.Z), HMM_MAX(a.W, b.W));
+}
+
+// Reserves room for the largest scene up front, updates run in the frame
+// after an edit and must not allocate.
+static void sdf_setup(size_t max_segments) {
+    stbds_arrsetcap(sdf.segments, max_segments);
+}
+
+static hmm_v2 sdf_cell_size(void) {
+    return HMM_Vec2(sdf.domain.Z / SDF_SIZE, sdf.domain.W / SDF_SIZE);
+}
+
+// How far from a segment its cells can be affected, in world units.
+static float sdf_reach(void) {
+    hmm_v2 cell = sdf_cell_size();
+    return SDF_MAX_DIST * HMM_MAX(cell.X, cell.Y) + HMM_LengthVec2(cell);
+}
+
+// Cells overlapping `bounds` (min.xy, max.zw), false if there are none.
+static bool sdf_cell_range(hmm_v4 bounds, int *x0, int *y0, int *x1, int *y1) {
+    hmm_v2 cell = sdf_cell_size();
+    *x0 = HMM_MAX(0, (int)floorf((bounds.X - sdf.domain.X) / cell.X));
+    *y0 = HMM_MAX(0, (int)floorf((bounds.Y - sdf.domain.Y) / cell.Y));
+    *x1 = HMM_MIN(SDF_SIZE - 1, (int)ceilf((bounds.Z - sdf.domain.X) / cell.X));
+    *y1 = HMM_MIN(SDF_SIZE - 1, (int)ceilf((bounds.W - sdf.domain.Y) / cell.Y));
+    return *x0 <= *x1 && *y0 <= *y1;
+}
+
+static void sdf_rebuild_region(hmm_v4 bounds) {
+    hmm_v2 cell = sdf_cell_size();
+    float half_diag = 0.5f * HMM_LengthVec2(cell);
+    float max_dist = SDF_MAX_DIST * HMM_MAX(cell.X, cell.Y);
+    float reach = sdf_reach();
+
+    int x0, y0, x1, y1;
+    if (!sdf_cell_range(bounds, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+
+    // Only segments that can reach the region matter.
+    hmm_v4 region = HMM_Vec4(sdf.domain.X + x0 * cell.X,
+                             sdf.domain.Y + y0 * cell.Y,
+                             sdf.domain.X + (x1 + 1) * cell.X,
+                             sdf.domain.Y + (y1 + 1) * cell.Y);
+    hmm_v4 *candidates = mem_frame_alloc(sizeof(hmm_v4) * stbds_arrlenu(sdf.segments));
+    size_t candidate_count = 0;
+    for (size_t i = 0; i < stbds_arrlenu(sdf.segments); i++) {
+        hmm_v4 b = sdf_segment_bounds(sdf.segments[i]);
+        if (b.X - reach <= region.Z && b.Z + reach >= region.X && b.Y - reach <= region.W &&
+            b.W + reach >= region.Y) {
+            candidates[candidate_count++] = sdf.segments[i];
+        }
+    }
+
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            hmm_v2 p = HMM_Vec2(sdf.domain.X + (x + 0.5f) * cell.X, sdf.domain.Y + (y + 0.5f) * cell.Y);
+            float d = max_dist + half_diag;
+            for (size_t i = 0; i < candidate_count; i++) {
+                d = HMM_MIN(d, sdf_segment_distance(p, candidates[i]));
+            }
+            sdf.cells[y * SDF_SIZE + x].X = HMM_Clamp(0.0f, d - half_diag, max_dist);
+        }
+    }
+    sdf.dirty = true;
+}
+
+// The tracer looks for hits up to one cell diagonal past a point in a cell,
+// so a cell lists every segment within that of any of its points. Rebuilt
+// whole on every change, removing segments shifts all indices after them.
+static void sdf_rebuild_lists(void) {
+    hmm_v2 cell = sdf_cell_size();
+    float reach = 1.5f * HMM_LengthVec2(cell);
+    size_t segment_count = stbds_arrlenu(sdf.segments);
+    uint32_t *fill = mem_frame_alloc(sizeof(uint32_t) * SDF_SIZE * SDF_SIZE);
+    memset(fill, 0, sizeof(uint32_t) * SDF_SIZE * SDF_SIZE);
+
+    // Counts first, then fills the ranges laid out in between.
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            size_t first = 0;
+            for (size_t c = 0; c < SDF_SIZE * SDF_SIZE; c++) {
+                bool fits = first + fill[c] <= SDF_ITEMS_MAX;
+                sdf.cells[c].Y = (float)first;
+                sdf.cells[c].Z = fits ? (float)fill[c] : -1.0f;
+                first += fits ? fill[c] : 0;
+                fill[c] = 0;
+            }
+            sdf.item_count = first;
+        }
+        for (size_t i = 0; i < segment_count; i++) {
+            hmm_v4 s = sdf.segments[i];
+            hmm_v4 b = sdf_segment_bounds(s);
+            b = HMM_Vec4(b.X - reach, b.Y - reach, b.Z + reach, b.W + reach);
+            int x0, y0, x1, y1;
+            if (!sdf_cell_range(b, &x0, &y0, &x1, &y1)) {
+                continue;
+            }
+            for (int y = y0; y <= y1; y++) {
+                for (int x = x0; x <= x1; x++) {
+                    size_t c = (size_t)y * SDF_SIZE + x;
+                    hmm_v2 p =
+                        HMM_Vec2(sdf.domain.X + (x + 0.5f) * cell.X, sdf.domain.Y + (y + 0.5f) * cell.Y);
+                    if (sdf.cells[c].X > 0.0f || sdf_segment_distance(p, s) > reach) {
+                        continue;
+                    }
+                    if (pass == 0) {
+                        fill[c]++;
+                    } else if (sdf.cells[c].Z >= 0.0f) {
+                        sdf.items[(size_t)sdf.cells[c].Y + fill[c]++] = (float)i;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static int sdf_compare_segments(const void *a, const void *b) {
+    return memcmp(a, b, sizeof(hmm_v4));
+}
+
+static hmm_v4 *sdf_sorted_copy(const hmm_v4 *segments, size_t count) {
+    hmm_v4 *copy = mem_frame_alloc(sizeof(hmm_v4) * count);
+    memcpy(copy, segments, sizeof(hmm_v4) * count);
+    qsort(copy, count, sizeof(hmm_v4), sdf_compare_segments);
+    return copy;
+}
+
+// Drops all state, the next update rebuilds the whole field.
+static void sdf_reset(void) {
+    stbds_arrsetlen(sdf.segments, 0);
+    sdf.domain = HMM_Vec4(0.0f, 0.0f, 0.0f, 0.0f);
+}
+
+// Brings the field up to date with `segments`, rebuilding only the cells
+// around segments that were added or removed since the last update.
+// `bounds` (min.xy, max.zw) is the area rays start from.
+static void sdf_update(const hmm_v4 *segments, size_t count, hmm_v4 bounds) {
+    size_t mark = mem_frame_mark();
+    for (size_t i = 0; i < count; i++) {
+        bounds = sdf_union(bounds, sdf_segment_bounds(segments[i]));
+    }
+    hmm_v4 domain = HMM_Vec4(
+        bounds.X - 1.0f, bounds.Y - 1.0f, bounds.Z - bounds.X + 2.0f, bounds.W - bounds.Y + 2.0f);
+
+    if (memcmp(&domain, &sdf.domain, sizeof(domain)) != 0) {
+        sdf.domain = domain;
+        stbds_arrsetlen(sdf.segments, 0);
+        for (size_t i = 0; i < count; i++) {
+            stbds_arrput(sdf.segments, segments[i]);
+        }
+        sdf_rebuild_region(HMM_Vec4(domain.X, domain.Y, domain.X + domain.Z, domain.Y + domain.W));
+        sdf_rebuild_lists();
+        mem_frame_release(mark);
+        return;
+    }
+
+    // Symmetric difference between the old and the new segment lists.
+    size_t old_count = stbds_arrlenu(sdf.segments);
+    hmm_v4 *old_sorted = sdf_sorted_copy(sdf.segments, old_count);
+    hmm_v4 *new_sorted = sdf_sorted_copy(segments, count);
+    bool changed = false;
+    hmm_v4 dirty = {0};
+    size_t io = 0;
+    size_t in = 0;
+    while (io < old_count || in < count) {
+        int cmp = io == old_count ? 1
+                  : in == count   ? -1
+                                  : sdf_compare_segments(&old_sorted[io], &new_sorted[in]);
+        if (cmp == 0) {
+            io++;
+            in++;
+            continue;
+        }
+        hmm_v4 b = sdf_segment_bounds(cmp < 0 ? old_sorted[io++] : new_sorted[in++]);
+        dirty = changed ? sdf_union(dirty, b) : b;
+        changed = true;
+    }
+    if (!changed) {
+        mem_frame_release(mark);
+        return;
+    }
+
+    stbds_arrsetlen(sdf.segments, 0);
+    for (size_t i = 0; i < count; i++) {
+        stbds_arrput(sdf.segments, segments[i]);
+    }
+    float reach = sdf_reach();
+    sdf_rebuild_region(HMM_Vec4(dirty.X - reach, dirty.Y - reach, dirty.Z + reach, dirty.W + reach));
+    sdf_rebuild_lists();
+    mem_frame_release(mark);
+}
+
+#endif
@@ -16,10 +16,14 @@ void main() {
 #pragma sokol @end
 
 #pragma sokol @fs fs_trace
+// BOUNCE_COUNT, SAMPLE_COUNT, DIST_COEF, LIGHT_COEF, RUSSIAN_ROULETTE and
+// RR_MIN_BOUNCE, generated per variant by the Makefile.
+#pragma sokol @include_block trace_config
 
 #define PI 3.1415927
 
 #define SHAPE_MAX_COUNT 512
+#define SDF_MAX_STEPS 64
 
 #define MAT_DIFFUSE 0.0
 #define MAT_REFLECT 1.0
@@ -28,11 +32,16 @@ void main() {
 uniform fs_trace_params {
     vec4 shape_vertices[SHAPE_MAX_COUNT];
     vec4 shape_materials[SHAPE_MAX_COUNT];
+    vec4 sdf_domain;
     float shape_count;
     float sample_count;
     float time;
+    float sdf_enabled;
 };
 uniform sampler2D prev_target;
+// Distance, first item and item count per cell, see sdf.h.
+uniform sampler2D sdf;
+uniform sampler2D sdf_items;
 
 out vec4 frag_color;
 
@@ -97,13 +106,79 @@ void intersect(ray r, inout intersection isect) {
     }
 }
 
-#define BOUNCE_COUNT 4
+vec4 sdfFetch(vec2 p) {
+    ivec2 size = textureSize(sdf, 0);
+    ivec2 cell = ivec2((p - sdf_domain.xy) / sdf_domain.zw * vec2(size));
+    return texelFetch(sdf, min(cell, size - 1), 0);
+}
+
+bool sdfContains(vec2 p) {
+    return all(greaterThanEqual(p, sdf_domain.xy)) && all(lessThan(p, sdf_domain.xy + sdf_domain.zw));
+}
+
+// Like intersect(), but skips shapes that can't pass within radius of p.
+void intersectNear(ray r, vec2 p, float radius, inout intersection isect) {
+    shape s;
+    for (uint i = 0; i < shape_count; i++) {
+        fetchShape(i, s);
+        vec2 d = (s.a + s.b) * 0.5 - p;
+        float reach = length(s.b - s.a) * 0.5 + radius;
+        if (dot(d, d) > reach * reach)
+            continue;
+        intersectLine(r, s.a, s.b, s.mat, s.color, isect);
+    }
+}
+
+// Only tests the shapes listed for one distance field cell.
+void intersectCell(ray r, vec4 cell, inout intersection isect) {
+    shape s;
+    int width = textureSize(sdf_items, 0).x;
+    int first = int(cell.y);
+    int last = first + int(cell.z);
+    for (int i = first; i < last; i++) {
+        uint index = uint(texelFetch(sdf_items, ivec2(i % width, i / width), 0).r);
+        fetchShape(index, s);
+        intersectLine(r, s.a, s.b, s.mat, s.color, isect);
+    }
+}
+
+// Marches the ray through the distance field and only runs the exact test
+// near geometry, accepting hits within one cell of the march point so that
+// no closer shape can be missed.
+void intersectAccel(ray r, inout intersection isect) {
+    float dlen = length(r.dir);
+    float radius = length(sdf_domain.zw / vec2(textureSize(sdf, 0)));
+    float s = isect.tMin * dlen;
+    for (uint i = 0; i < SDF_MAX_STEPS; i++) {
+        vec2 p = r.origin + r.dir * (s / dlen);
+        if (!sdfContains(p))
+            return;
+        vec4 cell = sdfFetch(p);
+        if (cell.x > 0.0) {
+            s += cell.x;
+            continue;
+        }
+        intersection near = isect;
+        near.tMax = min(isect.tMax, (s + radius) / dlen);
+        float limit = near.tMax;
+        if (cell.z >= 0.0)
+            intersectCell(r, cell, near);
+        else
+            intersectNear(r, p, radius, near);
+        if (near.tMax < limit) {
+            isect = near;
+            return;
+        }
+        s += radius;
+    }
+    // Out of steps, everything before s is known to be empty.
+    isect.tMin = s / dlen;
+    intersect(r, isect);
+}
+
 #define T_MIN 1e-4
 #define T_MAX 1e30
 
-#define DIST_COEF 0.35
-#define LIGHT_COEF 2.0
-
 vec3 traceRay(ray r, uint isample) {
     vec3 color = vec3(0.0);
     vec3 mask = vec3(1.0);
@@ -112,7 +187,10 @@ vec3 traceRay(ray r, uint isample) {
         intersection isect;
         isect.tMin = T_MIN;
         isect.tMax = T_MAX;
-        intersect(r, isect);
+        if (sdf_enabled > 0.0)
+            intersectAccel(r, isect);
+        else
+            intersect(r, isect);
 
         if (isect.tMax == T_MAX) {
             // no hit
@@ -138,13 +216,20 @@ vec3 traceRay(ray r, uint isample) {
             // r.origin += normalize(r.dir);
             mask *= isect.color;
         }
+
+#if RUSSIAN_ROULETTE
+        if (ibounce >= RR_MIN_BOUNCE) {
+            float survive = clamp(max(mask.r, max(mask.g, mask.b)), 0.05, 1.0);
+            if (rand(vec2(12.9898, 78.233), time + sample_count + isample + ibounce) > survive)
+                break;
+            mask /= survive;
+        }
+#endif
     }
 
     return color;
 }
 
-#define SAMPLE_COUNT 1
-
 vec3 computeColor(vec2 coord) {
     vec3 color = vec3(0.0);
 
@@ -12,6 +12,40 @@
 #define HANDMADE_MATH_NO_SSE
 #include "vendor/Handmade-Math/HandmadeMath.h"
 
+#define MEM_IMPL
+#include "src/mem.h"
+
 #define STB_DS_IMPLEMENTATION
 #define STBDS_NO_SHORT_NAMES
 #include "vendor/stb/stb_ds.h"
+
+#include <stdatomic.h>
+
+void mtl_read_image_async(sg_image img_id, int width, int height, void *dst, atomic_bool *done) {
+    _sg_image_t *img = _sg_lookup_image(&_sg.pools, img_id.id);
+    SOKOL_ASSERT(img);
+    id<MTLTexture> tex = _sg_mtl_id(img->mtl.tex[0]);
+    NSUInteger row_size = (NSUInteger)width * 4 * sizeof(float);
+    NSUInteger size = row_size * height;
+    id<MTLBuffer> buf = [tex.device newBufferWithLength:size options:MTLResourceStorageModeShared];
+
+    // Same queue as sokol, so this runs after the passes committed so far.
+    id<MTLCommandBuffer> cmd_buffer = [_sg.mtl.cmd_queue commandBuffer];
+    id<MTLBlitCommandEncoder> blit = [cmd_buffer blitCommandEncoder];
+    [blit copyFromTexture:tex
+                 sourceSlice:0
+                 sourceLevel:0
+                sourceOrigin:MTLOriginMake(0, 0, 0)
+                  sourceSize:MTLSizeMake(width, height, 1)
+                    toBuffer:buf
+           destinationOffset:0
+      destinationBytesPerRow:row_size
+    destinationBytesPerImage:size];
+    [blit endEncoding];
+    [cmd_buffer addCompletedHandler:^(id<MTLCommandBuffer> cb) {
+      (void)cb;
+      memcpy(dst, buf.contents, size);
+      atomic_store(done, true);
+    }];
+    [cmd_buffer commit];
+}
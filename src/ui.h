@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "mem.h"
+
 #define SOKOL_METAL
 #include <vendor/sokol/sokol_app.h>
 #include <vendor/sokol/sokol_gfx.h>
@@ -13,17 +15,29 @@
 
 #include <vendor/microui/demo/atlas.inl>
 
+#define UI_LINE_MAX_COUNT 1024
+
+typedef struct {
+    float x0;
+    float y0;
+    float x1;
+    float y1;
+    mu_Color color;
+} ui_line;
+
 static struct {
     mu_Context ctx;
     sg_image atlas_img;
     sgl_pipeline pipeline;
+    ui_line lines[UI_LINE_MAX_COUNT];
+    size_t line_count;
 } ui;
 
 static void r_init(void) {
     // Atlas image data is in atlas.inl file, this only contains alpha
     // values, need to expand this to RGBA8.
     uint32_t rgba8_size = ATLAS_WIDTH * ATLAS_HEIGHT * 4;
-    uint32_t *rgba8_pixels = (uint32_t *)malloc(rgba8_size);
+    uint32_t *rgba8_pixels = (uint32_t *)mem_heap_alloc(rgba8_size);
     for (int y = 0; y < ATLAS_HEIGHT; y++) {
         for (int x = 0; x < ATLAS_WIDTH; x++) {
             uint32_t index = y * ATLAS_WIDTH + x;
@@ -44,7 +58,7 @@ static void r_init(void) {
                   .dst_factor_rgb = SG_BLENDFACTOR_ONE_MINUS_SRC_ALPHA},
     });
 
-    free(rgba8_pixels);
+    mem_heap_free(rgba8_pixels);
 }
 
 static void r_begin(float width, float height, float dpi_scale) {
@@ -87,6 +101,25 @@ static void r_push_quad(mu_Rect dst, mu_Rect src, mu_Color color) {
     sgl_v2f_t2f(x0, y1, u0, v1);
 }
 
+static void r_draw_lines(void) {
+    if (ui.line_count == 0) {
+        return;
+    }
+    sgl_end();
+    sgl_disable_texture();
+    sgl_begin_lines();
+    for (size_t i = 0; i < ui.line_count; i++) {
+        ui_line l = ui.lines[i];
+        sgl_c4b(l.color.r, l.color.g, l.color.b, l.color.a);
+        sgl_v2f(l.x0, l.y0);
+        sgl_v2f(l.x1, l.y1);
+    }
+    sgl_end();
+    sgl_enable_texture();
+    sgl_begin_quads();
+    ui.line_count = 0;
+}
+
 static void r_draw_rect(mu_Rect rect, mu_Color color) {
     r_push_quad(rect, atlas[ATLAS_WHITE], color);
 }
@@ -154,9 +187,17 @@ static void ui_shutdown(void) {
     sgl_shutdown();
 }
 
+// Queues a line in points for the next ui_render(), drawn under the HUD.
+static void ui_draw_line(float x0, float y0, float x1, float y1, mu_Color color) {
+    if (ui.line_count < UI_LINE_MAX_COUNT) {
+        ui.lines[ui.line_count++] = (ui_line){x0, y0, x1, y1, color};
+    }
+}
+
 static void ui_render(float width, float height, float dpi_scale) {
     mu_Command *cmd = NULL;
     r_begin(width, height, dpi_scale);
+    r_draw_lines();
     while (mu_next_command(&ui.ctx, &cmd)) {
         switch (cmd->type) {
         case MU_COMMAND_TEXT:
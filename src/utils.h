@@ -2,6 +2,8 @@
 #define INCLUDE_UTILS
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -17,4 +19,14 @@ static void expect(bool condition, const char *msg) {
     }
 }
 
+#define HASH_SEED 0xcbf29ce484222325ull
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
 #endif